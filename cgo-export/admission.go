@@ -0,0 +1,241 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+/*
+#include <stdint.h>
+#include "../vci.h"
+*/
+import "C"
+import (
+	"sort"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/danos/mgmterror"
+)
+
+/*
+Calls into a model's handlers may be limited per model and per RPC. A
+gate admits up to maxInFlight calls at once and queues up to maxQueued
+more in arrival order; a call that finds the queue full is rejected at
+once with an operation-failed error tagged vci-overloaded. An RPC passes
+its own gate and then its model's, config set and check pass the model's.
+A get cannot fail, so gets wait for a slot in the model's gate but are
+never rejected.
+
+Gates start out unlimited and cost an atomic load per call until limits
+are first set on them, from then on calls are counted under the gate's
+lock. Limits may be changed at any time.
+*/
+
+const overloadedAppTag = "vci-overloaded"
+
+type gateKey struct {
+	component string
+	model     string
+	module    string
+	name      string
+}
+
+type admissionGate struct {
+	// Kept first so that it is 64 bit aligned on 32 bit targets.
+	wait     histogram
+	admitted uint64
+	rejected uint64
+	limited  uint32
+
+	mu          sync.Mutex
+	maxInFlight int
+	maxQueued   int
+	inFlight    int
+	waiters     []chan struct{}
+}
+
+var admissionGates sync.Map // gateKey -> *admissionGate
+
+func admissionGateFor(key gateKey) *admissionGate {
+	if g, ok := admissionGates.Load(key); ok {
+		return g.(*admissionGate)
+	}
+	g, _ := admissionGates.LoadOrStore(key, new(admissionGate))
+	return g.(*admissionGate)
+}
+
+func modelGate(component, model string) *admissionGate {
+	return admissionGateFor(gateKey{component: component, model: model})
+}
+
+func rpcGate(m *model, module, name string) *admissionGate {
+	return admissionGateFor(gateKey{
+		component: m.component,
+		model:     m.name,
+		module:    module,
+		name:      name,
+	})
+}
+
+func overloadedError() error {
+	err := mgmterror.NewOperationFailedApplicationError()
+	err.AppTag = overloadedAppTag
+	err.Message = "too many calls in progress"
+	return err
+}
+
+// enter waits for the call to be admitted, or when reject is set fails
+// if the queue is full. tracked says whether exit has anything to undo.
+func (g *admissionGate) enter(reject bool) (tracked bool, err error) {
+	if g == nil || atomic.LoadUint32(&g.limited) == 0 {
+		return false, nil
+	}
+	g.mu.Lock()
+	if g.maxInFlight == 0 || g.inFlight < g.maxInFlight {
+		g.inFlight++
+		g.mu.Unlock()
+		g.admit(0)
+		return true, nil
+	}
+	if reject && g.maxQueued != 0 && len(g.waiters) >= g.maxQueued {
+		g.mu.Unlock()
+		atomic.AddUint64(&g.rejected, 1)
+		return false, overloadedError()
+	}
+	ready := make(chan struct{})
+	g.waiters = append(g.waiters, ready)
+	g.mu.Unlock()
+	start := time.Now()
+	<-ready
+	g.admit(time.Since(start))
+	return true, nil
+}
+
+func (g *admissionGate) admit(waited time.Duration) {
+	g.wait.add(waited)
+	atomic.AddUint64(&g.admitted, 1)
+}
+
+// wake admits as many waiters as the limits allow. Called with g.mu held.
+func (g *admissionGate) wake() {
+	for len(g.waiters) > 0 &&
+		(g.maxInFlight == 0 || g.inFlight < g.maxInFlight) {
+		g.inFlight++
+		close(g.waiters[0])
+		g.waiters[0] = nil
+		g.waiters = g.waiters[1:]
+	}
+}
+
+func (g *admissionGate) exit(tracked bool) {
+	if !tracked {
+		return
+	}
+	g.mu.Lock()
+	g.inFlight--
+	g.wake()
+	g.mu.Unlock()
+}
+
+// setLimits changes the limits, 0 leaving that limit off.
+func (g *admissionGate) setLimits(maxInFlight, maxQueued int) {
+	g.mu.Lock()
+	g.maxInFlight, g.maxQueued = maxInFlight, maxQueued
+	g.wake()
+	atomic.StoreUint32(&g.limited, 1)
+	g.mu.Unlock()
+}
+
+type admissionSnapshot struct {
+	maxInFlight, maxQueued, inFlight, queued int
+	admitted, rejected                       uint64
+	p50, p99, p999                           uint64
+}
+
+func (g *admissionGate) snapshot() admissionSnapshot {
+	g.mu.Lock()
+	snap := admissionSnapshot{
+		maxInFlight: g.maxInFlight,
+		maxQueued:   g.maxQueued,
+		inFlight:    g.inFlight,
+		queued:      len(g.waiters),
+	}
+	g.mu.Unlock()
+	snap.admitted = atomic.LoadUint64(&g.admitted)
+	snap.rejected = atomic.LoadUint64(&g.rejected)
+	snap.p50, snap.p99, snap.p999 = g.wait.quantiles()
+	return snap
+}
+
+func (g *admissionGate) stats(out *C.vci_admission_statistics) {
+	snap := g.snapshot()
+	out.max_in_flight = C.uint32_t(snap.maxInFlight)
+	out.max_queued = C.uint32_t(snap.maxQueued)
+	out.in_flight = C.uint32_t(snap.inFlight)
+	out.queued = C.uint32_t(snap.queued)
+	out.admitted = C.uint64_t(snap.admitted)
+	out.rejected = C.uint64_t(snap.rejected)
+	out.wait_p50_ns = C.uint64_t(snap.p50)
+	out.wait_p99_ns = C.uint64_t(snap.p99)
+	out.wait_p999_ns = C.uint64_t(snap.p999)
+}
+
+// limitedGates returns the gates of component that have had limits set,
+// ordered by model, module and name.
+func limitedGates(component string) ([]gateKey, []admissionSnapshot) {
+	var keys []gateKey
+	admissionGates.Range(func(k, v interface{}) bool {
+		key := k.(gateKey)
+		g := v.(*admissionGate)
+		if key.component == component &&
+			atomic.LoadUint32(&g.limited) != 0 {
+			keys = append(keys, key)
+		}
+		return true
+	})
+	sort.Slice(keys, func(i, j int) bool {
+		a, b := keys[i], keys[j]
+		switch {
+		case a.model != b.model:
+			return a.model < b.model
+		case a.module != b.module:
+			return a.module < b.module
+		}
+		return a.name < b.name
+	})
+	snaps := make([]admissionSnapshot, len(keys))
+	for i, key := range keys {
+		snaps[i] = admissionGateFor(key).snapshot()
+	}
+	return keys, snaps
+}
+
+// admission is the pair of gates a handler passes.
+type admission struct {
+	rpc, model *admissionGate
+}
+
+// admissionTicket records which gates admitted a call.
+type admissionTicket struct {
+	rpc, model bool
+}
+
+func (a admission) enter(reject bool) (admissionTicket, error) {
+	var t admissionTicket
+	var err error
+	if t.rpc, err = a.rpc.enter(reject); err != nil {
+		return t, err
+	}
+	if t.model, err = a.model.enter(reject); err != nil {
+		a.rpc.exit(t.rpc)
+		return admissionTicket{}, err
+	}
+	return t, nil
+}
+
+func (a admission) exit(t admissionTicket) {
+	a.model.exit(t.model)
+	a.rpc.exit(t.rpc)
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+import (
+	"testing"
+	"time"
+)
+
+// TestAdmissionUnlimited checks that limits of 0 leave a gate open: no
+// call waits and none is rejected.
+func TestAdmissionUnlimited(t *testing.T) {
+	g := new(admissionGate)
+	g.setLimits(0, 0)
+	var tracked []bool
+	for i := 0; i < 100; i++ {
+		tr, err := g.enter(true)
+		if err != nil {
+			t.Fatalf("call %d rejected: %s", i, err)
+		}
+		tracked = append(tracked, tr)
+	}
+	for _, tr := range tracked {
+		g.exit(tr)
+	}
+	if snap := g.snapshot(); snap.rejected != 0 || snap.admitted != 100 ||
+		snap.inFlight != 0 {
+		t.Errorf("admitted %d, rejected %d, %d in flight",
+			snap.admitted, snap.rejected, snap.inFlight)
+	}
+}
+
+// TestAdmissionUnboundedQueue checks that a max_queued of 0 queues every
+// call over max_in_flight rather than rejecting it.
+func TestAdmissionUnboundedQueue(t *testing.T) {
+	const waiters = 10
+	g := new(admissionGate)
+	g.setLimits(1, 0)
+	first, err := g.enter(true)
+	if err != nil {
+		t.Fatal(err)
+	}
+	errs := make(chan error, waiters)
+	for i := 0; i < waiters; i++ {
+		go func() {
+			tr, err := g.enter(true)
+			g.exit(tr)
+			errs <- err
+		}()
+	}
+	for g.snapshot().queued != waiters {
+		time.Sleep(time.Millisecond)
+	}
+	g.exit(first)
+	for i := 0; i < waiters; i++ {
+		if err := <-errs; err != nil {
+			t.Errorf("queued call rejected: %s", err)
+		}
+	}
+	if snap := g.snapshot(); snap.rejected != 0 || snap.admitted != waiters+1 {
+		t.Errorf("admitted %d, rejected %d", snap.admitted, snap.rejected)
+	}
+}
+
+// TestAdmissionQueueFull checks that a call finding the queue full is
+// rejected once both limits are set.
+func TestAdmissionQueueFull(t *testing.T) {
+	g := new(admissionGate)
+	g.setLimits(1, 1)
+	first, _ := g.enter(true)
+	done := make(chan struct{})
+	go func() {
+		tr, _ := g.enter(true)
+		g.exit(tr)
+		close(done)
+	}()
+	for g.snapshot().queued != 1 {
+		time.Sleep(time.Millisecond)
+	}
+	if _, err := g.enter(true); err == nil {
+		t.Error("call over a full queue was admitted")
+	}
+	g.exit(first)
+	<-done
+	if snap := g.snapshot(); snap.rejected != 1 {
+		t.Errorf("rejected %d, want 1", snap.rejected)
+	}
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+/*
+#include <stdlib.h>
+#include "../vci.h"
+*/
+import "C"
+import (
+	"runtime"
+	"sync"
+	"unsafe"
+)
+
+/*
+Output buffers handed to v2 handlers are allocated in C so the handler can
+grow them with realloc, and are recycled through a sync.Pool so a steady
+stream of replies is written into memory reused from call to call. The
+pool keeps per-P caches, so in practice each runtime thread keeps reusing
+its own buffers. Buffers that grew unusually large are trimmed before they
+go back into the pool so one huge reply does not pin its memory forever.
+*/
+
+const cBufMaxRetained = 16 << 20
+
+type cBuf struct {
+	buf *C.vci_buf
+}
+
+var cBufPool = sync.Pool{
+	New: func() interface{} {
+		return newCBuf()
+	},
+}
+
+func newCBuf() *cBuf {
+	out := &cBuf{
+		buf: (*C.vci_buf)(C.calloc(1, C.sizeof_vci_buf)),
+	}
+	runtime.SetFinalizer(out, func(b *cBuf) {
+		C.free(unsafe.Pointer(b.buf.data))
+		C.free(unsafe.Pointer(b.buf))
+	})
+	return out
+}
+
+func getCBuf() *cBuf {
+	return cBufPool.Get().(*cBuf)
+}
+
+func (b *cBuf) bytes() encodedString {
+	return goPayload(unsafe.Pointer(b.buf.data), b.buf.len)
+}
+
+func (b *cBuf) release() {
+	b.buf.len = 0
+	if b.buf.cap > cBufMaxRetained {
+		C.free(unsafe.Pointer(b.buf.data))
+		b.buf.data = nil
+		b.buf.cap = 0
+	}
+	cBufPool.Put(b)
+}
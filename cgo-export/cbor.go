@@ -0,0 +1,778 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+import (
+	"encoding/base64"
+	"errors"
+	"math"
+	"strconv"
+	"unicode/utf16"
+	"unicode/utf8"
+)
+
+/*
+Payloads may be handed to and taken from C in CBOR (RFC 8949) rather than
+JSON. Both carry the RFC 7951 data model, so a document is transcoded
+directly from one to the other without building it as Go values:
+
+	JSON object, array         CBOR map with text keys, array
+	JSON string                CBOR text string
+	JSON integer               CBOR unsigned or negative integer
+	other JSON numbers         CBOR float, single precision when exact
+	true, false, null          CBOR simple values 21, 20 and 22
+
+CBOR byte strings are accepted and become base64 strings, which is how
+RFC 7951 encodes binary leaves. Indefinite length items are accepted,
+tags and the other simple values are not. The CBOR produced always uses
+definite lengths, which needs the element counts of every container up
+front, so JSON is scanned twice: once to count and once to convert.
+*/
+
+// Bounds how deeply documents may nest, so a hostile one cannot run the
+// transcoder out of stack.
+const maxNesting = 10000
+
+var (
+	errJSONSyntax  = errors.New("json: invalid document")
+	errCBORSyntax  = errors.New("cbor: invalid document")
+	errCBORItem    = errors.New("cbor: item has no RFC 7951 equivalent")
+	errCBORKey     = errors.New("cbor: map keys must be text strings")
+	errTooDeep     = errors.New("document nests too deeply")
+	errInvalidUTF8 = errors.New("string is not valid UTF-8")
+)
+
+const (
+	cborUint   = 0
+	cborNegInt = 1
+	cborBytes  = 2
+	cborText   = 3
+	cborArray  = 4
+	cborMap    = 5
+	cborTag    = 6
+	cborSimple = 7
+
+	cborFalse   = 0xf4
+	cborTrue    = 0xf5
+	cborNull    = 0xf6
+	cborFloat16 = 0xf9
+	cborFloat32 = 0xfa
+	cborFloat64 = 0xfb
+	cborBreak   = 0xff
+
+	cborIndefinite = 31
+
+	// The magnitude of the most negative CBOR integer, -2^64.
+	minCBORNegInt = "18446744073709551616"
+)
+
+func appendCBORHead(dst []byte, major byte, n uint64) []byte {
+	major <<= 5
+	switch {
+	case n < 24:
+		return append(dst, major|byte(n))
+	case n <= math.MaxUint8:
+		return append(dst, major|24, byte(n))
+	case n <= math.MaxUint16:
+		return append(dst, major|25, byte(n>>8), byte(n))
+	case n <= math.MaxUint32:
+		return append(dst, major|26,
+			byte(n>>24), byte(n>>16), byte(n>>8), byte(n))
+	}
+	return append(dst, major|27,
+		byte(n>>56), byte(n>>48), byte(n>>40), byte(n>>32),
+		byte(n>>24), byte(n>>16), byte(n>>8), byte(n))
+}
+
+func isJSONSpace(c byte) bool {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r'
+}
+
+// jsonToCBOR appends the CBOR encoding of the JSON document src to dst.
+// An empty document stays empty.
+func jsonToCBOR(dst, src []byte) ([]byte, error) {
+	t := jsonTranscoder{src: src, dst: dst}
+	t.skipSpace()
+	if t.pos == len(src) {
+		return dst, nil
+	}
+	t.counts = countJSONElements(src)
+	if err := t.value(0); err != nil {
+		return nil, err
+	}
+	t.skipSpace()
+	if t.pos != len(src) {
+		return nil, errJSONSyntax
+	}
+	return t.dst, nil
+}
+
+// countJSONElements returns the number of members of every object and
+// array in src, in the order they open. It only tracks structure; the
+// document is validated as it is converted.
+func countJSONElements(src []byte) []int {
+	var counts []int
+	var open []int
+	var empty []bool
+	for i := 0; i < len(src); i++ {
+		c := src[i]
+		switch c {
+		case '{', '[':
+			if n := len(empty); n > 0 {
+				empty[n-1] = false
+			}
+			open = append(open, len(counts))
+			empty = append(empty, true)
+			counts = append(counts, 0)
+		case '}', ']':
+			if n := len(open); n > 0 {
+				if !empty[n-1] {
+					counts[open[n-1]]++
+				}
+				open, empty = open[:n-1], empty[:n-1]
+			}
+		case ',':
+			if n := len(open); n > 0 {
+				counts[open[n-1]]++
+			}
+		case ':', ' ', '\t', '\n', '\r':
+		default:
+			if n := len(empty); n > 0 {
+				empty[n-1] = false
+			}
+			if c == '"' {
+				for i++; i < len(src) && src[i] != '"'; i++ {
+					if src[i] == '\\' {
+						i++
+					}
+				}
+			}
+		}
+	}
+	return counts
+}
+
+type jsonTranscoder struct {
+	src       []byte
+	pos       int
+	dst       []byte
+	counts    []int
+	nextCount int
+	scratch   []byte
+}
+
+func (t *jsonTranscoder) skipSpace() {
+	for t.pos < len(t.src) && isJSONSpace(t.src[t.pos]) {
+		t.pos++
+	}
+}
+
+// next skips white space and returns the next byte without consuming it.
+func (t *jsonTranscoder) next() (byte, error) {
+	t.skipSpace()
+	if t.pos == len(t.src) {
+		return 0, errJSONSyntax
+	}
+	return t.src[t.pos], nil
+}
+
+func (t *jsonTranscoder) literal(word string, out byte) error {
+	if len(t.src)-t.pos < len(word) ||
+		string(t.src[t.pos:t.pos+len(word)]) != word {
+		return errJSONSyntax
+	}
+	t.pos += len(word)
+	t.dst = append(t.dst, out)
+	return nil
+}
+
+func (t *jsonTranscoder) value(depth int) error {
+	c, err := t.next()
+	if err != nil {
+		return err
+	}
+	switch {
+	case c == '{' || c == '[':
+		if depth >= maxNesting {
+			return errTooDeep
+		}
+		return t.composite(c, depth+1)
+	case c == '"':
+		return t.string()
+	case c == '-' || (c >= '0' && c <= '9'):
+		return t.number()
+	case c == 't':
+		return t.literal("true", cborTrue)
+	case c == 'f':
+		return t.literal("false", cborFalse)
+	case c == 'n':
+		return t.literal("null", cborNull)
+	}
+	return errJSONSyntax
+}
+
+func (t *jsonTranscoder) composite(open byte, depth int) error {
+	if t.nextCount >= len(t.counts) {
+		return errJSONSyntax
+	}
+	want := t.counts[t.nextCount]
+	t.nextCount++
+	major, close := byte(cborArray), byte(']')
+	if open == '{' {
+		major, close = cborMap, '}'
+	}
+	t.dst = appendCBORHead(t.dst, major, uint64(want))
+	t.pos++
+	c, err := t.next()
+	if err != nil {
+		return err
+	}
+	if c == close {
+		t.pos++
+		if want != 0 {
+			return errJSONSyntax
+		}
+		return nil
+	}
+	for n := 1; ; n++ {
+		if open == '{' {
+			if c != '"' {
+				return errJSONSyntax
+			}
+			if err := t.string(); err != nil {
+				return err
+			}
+			if c, err = t.next(); err != nil || c != ':' {
+				return errJSONSyntax
+			}
+			t.pos++
+		}
+		if err := t.value(depth); err != nil {
+			return err
+		}
+		if c, err = t.next(); err != nil {
+			return err
+		}
+		t.pos++
+		switch c {
+		case ',':
+			if c, err = t.next(); err != nil {
+				return err
+			}
+			continue
+		case close:
+			if n != want {
+				return errJSONSyntax
+			}
+			return nil
+		}
+		return errJSONSyntax
+	}
+}
+
+func (t *jsonTranscoder) string() error {
+	t.pos++
+	start := t.pos
+	for t.pos < len(t.src) {
+		c := t.src[t.pos]
+		switch {
+		case c == '"':
+			s := t.src[start:t.pos]
+			t.pos++
+			if !utf8.Valid(s) {
+				return errInvalidUTF8
+			}
+			t.dst = appendCBORHead(t.dst, cborText, uint64(len(s)))
+			t.dst = append(t.dst, s...)
+			return nil
+		case c == '\\':
+			return t.escapedString(start)
+		case c < 0x20:
+			return errJSONSyntax
+		}
+		t.pos++
+	}
+	return errJSONSyntax
+}
+
+// escapedString finishes a string that contains escapes, which has to
+// be decoded before its length is known.
+func (t *jsonTranscoder) escapedString(start int) error {
+	s := append(t.scratch[:0], t.src[start:t.pos]...)
+	for t.pos < len(t.src) {
+		c := t.src[t.pos]
+		switch {
+		case c == '"':
+			t.pos++
+			t.scratch = s
+			if !utf8.Valid(s) {
+				return errInvalidUTF8
+			}
+			t.dst = appendCBORHead(t.dst, cborText, uint64(len(s)))
+			t.dst = append(t.dst, s...)
+			return nil
+		case c < 0x20:
+			return errJSONSyntax
+		case c != '\\':
+			s = append(s, c)
+			t.pos++
+			continue
+		}
+		if t.pos+1 >= len(t.src) {
+			return errJSONSyntax
+		}
+		esc := t.src[t.pos+1]
+		t.pos += 2
+		switch esc {
+		case '"', '\\', '/':
+			s = append(s, esc)
+		case 'b':
+			s = append(s, '\b')
+		case 'f':
+			s = append(s, '\f')
+		case 'n':
+			s = append(s, '\n')
+		case 'r':
+			s = append(s, '\r')
+		case 't':
+			s = append(s, '\t')
+		case 'u':
+			r, ok := t.hex4()
+			if !ok {
+				return errJSONSyntax
+			}
+			if utf16.IsSurrogate(r) {
+				r2 := utf8.RuneError
+				if len(t.src)-t.pos >= 6 &&
+					t.src[t.pos] == '\\' && t.src[t.pos+1] == 'u' {
+					save := t.pos
+					t.pos += 2
+					if lo, ok := t.hex4(); ok {
+						r2 = utf16.DecodeRune(r, lo)
+					}
+					if r2 == utf8.RuneError {
+						t.pos = save
+					}
+				}
+				r = r2
+			}
+			s = append(s, string(r)...)
+		default:
+			return errJSONSyntax
+		}
+	}
+	return errJSONSyntax
+}
+
+func (t *jsonTranscoder) hex4() (rune, bool) {
+	if len(t.src)-t.pos < 4 {
+		return 0, false
+	}
+	var r rune
+	for _, c := range t.src[t.pos : t.pos+4] {
+		switch {
+		case c >= '0' && c <= '9':
+			c -= '0'
+		case c >= 'a' && c <= 'f':
+			c -= 'a' - 10
+		case c >= 'A' && c <= 'F':
+			c -= 'A' - 10
+		default:
+			return 0, false
+		}
+		r = r<<4 | rune(c)
+	}
+	t.pos += 4
+	return r, true
+}
+
+func (t *jsonTranscoder) digits() int {
+	start := t.pos
+	for t.pos < len(t.src) && t.src[t.pos] >= '0' && t.src[t.pos] <= '9' {
+		t.pos++
+	}
+	return t.pos - start
+}
+
+func (t *jsonTranscoder) number() error {
+	start := t.pos
+	neg := t.src[t.pos] == '-'
+	if neg {
+		t.pos++
+	}
+	intStart := t.pos
+	n := t.digits()
+	if n == 0 || (n > 1 && t.src[intStart] == '0') {
+		return errJSONSyntax
+	}
+	integer := true
+	if t.pos < len(t.src) && t.src[t.pos] == '.' {
+		t.pos++
+		if t.digits() == 0 {
+			return errJSONSyntax
+		}
+		integer = false
+	}
+	if t.pos < len(t.src) && (t.src[t.pos] == 'e' || t.src[t.pos] == 'E') {
+		t.pos++
+		if t.pos < len(t.src) && (t.src[t.pos] == '+' || t.src[t.pos] == '-') {
+			t.pos++
+		}
+		if t.digits() == 0 {
+			return errJSONSyntax
+		}
+		integer = false
+	}
+	if integer {
+		digits := t.src[intStart:t.pos]
+		if neg && string(digits) == minCBORNegInt {
+			t.dst = appendCBORHead(t.dst, cborNegInt, math.MaxUint64)
+			return nil
+		}
+		if v, ok := parseJSONUint(digits); ok {
+			switch {
+			case !neg:
+				t.dst = appendCBORHead(t.dst, cborUint, v)
+			case v == 0:
+				t.dst = append(t.dst, 0)
+			default:
+				t.dst = appendCBORHead(t.dst, cborNegInt, v-1)
+			}
+			return nil
+		}
+	}
+	f, err := strconv.ParseFloat(string(t.src[start:t.pos]), 64)
+	if err != nil {
+		return errJSONSyntax
+	}
+	if f32 := float32(f); float64(f32) == f {
+		b := math.Float32bits(f32)
+		t.dst = append(t.dst, cborFloat32,
+			byte(b>>24), byte(b>>16), byte(b>>8), byte(b))
+		return nil
+	}
+	b := math.Float64bits(f)
+	t.dst = append(t.dst, cborFloat64,
+		byte(b>>56), byte(b>>48), byte(b>>40), byte(b>>32),
+		byte(b>>24), byte(b>>16), byte(b>>8), byte(b))
+	return nil
+}
+
+// parseJSONUint parses a run of decimal digits, failing on overflow.
+func parseJSONUint(digits []byte) (uint64, bool) {
+	var v uint64
+	for _, c := range digits {
+		d := uint64(c - '0')
+		if v > (math.MaxUint64-d)/10 {
+			return 0, false
+		}
+		v = v*10 + d
+	}
+	return v, true
+}
+
+// cborToJSON appends the JSON encoding of the CBOR document src to dst.
+// An empty document stays empty.
+func cborToJSON(dst, src []byte) ([]byte, error) {
+	if len(src) == 0 {
+		return dst, nil
+	}
+	t := cborTranscoder{src: src, dst: dst}
+	if err := t.item(0); err != nil {
+		return nil, err
+	}
+	if t.pos != len(src) {
+		return nil, errCBORSyntax
+	}
+	return t.dst, nil
+}
+
+type cborTranscoder struct {
+	src     []byte
+	pos     int
+	dst     []byte
+	scratch []byte
+}
+
+// head reads an item's initial byte and argument. For indefinite length
+// items indefinite is set and n is meaningless.
+func (t *cborTranscoder) head() (major, info byte, n uint64, indefinite bool, err error) {
+	if t.pos >= len(t.src) {
+		return 0, 0, 0, false, errCBORSyntax
+	}
+	ib := t.src[t.pos]
+	t.pos++
+	major, info = ib>>5, ib&0x1f
+	var size int
+	switch {
+	case info < 24:
+		return major, info, uint64(info), false, nil
+	case info == 24:
+		size = 1
+	case info == 25:
+		size = 2
+	case info == 26:
+		size = 4
+	case info == 27:
+		size = 8
+	case info == cborIndefinite:
+		return major, info, 0, true, nil
+	default:
+		return 0, 0, 0, false, errCBORSyntax
+	}
+	if len(t.src)-t.pos < size {
+		return 0, 0, 0, false, errCBORSyntax
+	}
+	for _, b := range t.src[t.pos : t.pos+size] {
+		n = n<<8 | uint64(b)
+	}
+	t.pos += size
+	return major, info, n, false, nil
+}
+
+// atBreak consumes the break ending an indefinite length item, if that
+// is what comes next.
+func (t *cborTranscoder) atBreak() (bool, error) {
+	if t.pos >= len(t.src) {
+		return false, errCBORSyntax
+	}
+	if t.src[t.pos] == cborBreak {
+		t.pos++
+		return true, nil
+	}
+	return false, nil
+}
+
+// bytes returns the n bytes of a definite length string.
+func (t *cborTranscoder) bytes(n uint64) ([]byte, error) {
+	if n > uint64(len(t.src)-t.pos) {
+		return nil, errCBORSyntax
+	}
+	s := t.src[t.pos : t.pos+int(n)]
+	t.pos += int(n)
+	return s, nil
+}
+
+// stringData returns the contents of a byte or text string of the given
+// major type, joining the chunks of an indefinite length one.
+func (t *cborTranscoder) stringData(major byte, n uint64, indefinite bool) ([]byte, error) {
+	if !indefinite {
+		return t.bytes(n)
+	}
+	s := t.scratch[:0]
+	for {
+		done, err := t.atBreak()
+		if err != nil {
+			return nil, err
+		}
+		if done {
+			t.scratch = s
+			return s, nil
+		}
+		chunkMajor, _, n, indefinite, err := t.head()
+		if err != nil {
+			return nil, err
+		}
+		if chunkMajor != major || indefinite {
+			return nil, errCBORSyntax
+		}
+		chunk, err := t.bytes(n)
+		if err != nil {
+			return nil, err
+		}
+		s = append(s, chunk...)
+	}
+}
+
+func (t *cborTranscoder) item(depth int) error {
+	major, info, n, indefinite, err := t.head()
+	if err != nil {
+		return err
+	}
+	switch major {
+	case cborUint:
+		if indefinite {
+			return errCBORSyntax
+		}
+		t.dst = strconv.AppendUint(t.dst, n, 10)
+	case cborNegInt:
+		if indefinite {
+			return errCBORSyntax
+		}
+		switch {
+		case n <= math.MaxInt64:
+			t.dst = strconv.AppendInt(t.dst, -1-int64(n), 10)
+		case n == math.MaxUint64:
+			t.dst = append(append(t.dst, '-'), minCBORNegInt...)
+		default:
+			t.dst = append(t.dst, '-')
+			t.dst = strconv.AppendUint(t.dst, n+1, 10)
+		}
+	case cborBytes:
+		s, err := t.stringData(major, n, indefinite)
+		if err != nil {
+			return err
+		}
+		t.dst = append(t.dst, '"')
+		t.dst = appendBase64(t.dst, s)
+		t.dst = append(t.dst, '"')
+	case cborText:
+		s, err := t.stringData(major, n, indefinite)
+		if err != nil {
+			return err
+		}
+		if !utf8.Valid(s) {
+			return errInvalidUTF8
+		}
+		t.dst = appendJSONString(t.dst, s)
+	case cborArray, cborMap:
+		if depth >= maxNesting {
+			return errTooDeep
+		}
+		return t.container(major, n, indefinite, depth+1)
+	case cborTag:
+		return errCBORItem
+	case cborSimple:
+		return t.simple(info, n)
+	}
+	return nil
+}
+
+func (t *cborTranscoder) container(major byte, n uint64, indefinite bool, depth int) error {
+	open, close := byte('['), byte(']')
+	if major == cborMap {
+		open, close = '{', '}'
+	}
+	t.dst = append(t.dst, open)
+	for i := uint64(0); indefinite || i < n; i++ {
+		if indefinite {
+			done, err := t.atBreak()
+			if err != nil {
+				return err
+			}
+			if done {
+				break
+			}
+		} else if uint64(len(t.src)-t.pos) < n-i {
+			// Every remaining element takes at least a byte.
+			return errCBORSyntax
+		}
+		if i > 0 {
+			t.dst = append(t.dst, ',')
+		}
+		if major == cborMap {
+			if err := t.key(); err != nil {
+				return err
+			}
+			t.dst = append(t.dst, ':')
+		}
+		if err := t.item(depth); err != nil {
+			return err
+		}
+	}
+	t.dst = append(t.dst, close)
+	return nil
+}
+
+func (t *cborTranscoder) key() error {
+	if t.pos < len(t.src) && t.src[t.pos]>>5 != cborText {
+		return errCBORKey
+	}
+	return t.item(0)
+}
+
+func (t *cborTranscoder) simple(info byte, n uint64) error {
+	var f float64
+	bitSize := 32
+	switch info {
+	case cborFalse & 0x1f:
+		t.dst = append(t.dst, "false"...)
+		return nil
+	case cborTrue & 0x1f:
+		t.dst = append(t.dst, "true"...)
+		return nil
+	case cborNull & 0x1f:
+		t.dst = append(t.dst, "null"...)
+		return nil
+	case cborFloat16 & 0x1f:
+		f = float16ToFloat64(uint16(n))
+	case cborFloat32 & 0x1f:
+		f = float64(math.Float32frombits(uint32(n)))
+	case cborFloat64 & 0x1f:
+		f = math.Float64frombits(n)
+		bitSize = 64
+	default:
+		return errCBORItem
+	}
+	if math.IsNaN(f) || math.IsInf(f, 0) {
+		return errCBORItem
+	}
+	t.dst = strconv.AppendFloat(t.dst, f, 'g', -1, bitSize)
+	return nil
+}
+
+func float16ToFloat64(h uint16) float64 {
+	exp := int(h>>10) & 0x1f
+	mant := float64(h & 0x3ff)
+	var f float64
+	switch exp {
+	case 0:
+		f = math.Ldexp(mant, -24)
+	case 0x1f:
+		if mant == 0 {
+			f = math.Inf(1)
+		} else {
+			f = math.NaN()
+		}
+	default:
+		f = math.Ldexp(mant+1024, exp-25)
+	}
+	if h&0x8000 != 0 {
+		return -f
+	}
+	return f
+}
+
+func appendBase64(dst, src []byte) []byte {
+	n := base64.StdEncoding.EncodedLen(len(src))
+	if cap(dst)-len(dst) < n {
+		grown := make([]byte, len(dst), len(dst)+n+len(dst)/2)
+		copy(grown, dst)
+		dst = grown
+	}
+	base64.StdEncoding.Encode(dst[len(dst):len(dst)+n], src)
+	return dst[:len(dst)+n]
+}
+
+const hexDigits = "0123456789abcdef"
+
+// appendJSONString appends s, which must be valid UTF-8, as a JSON string.
+func appendJSONString(dst, s []byte) []byte {
+	dst = append(dst, '"')
+	start := 0
+	for i, c := range s {
+		if c >= 0x20 && c != '"' && c != '\\' {
+			continue
+		}
+		dst = append(dst, s[start:i]...)
+		switch c {
+		case '"', '\\':
+			dst = append(dst, '\\', c)
+		case '\n':
+			dst = append(dst, '\\', 'n')
+		case '\r':
+			dst = append(dst, '\\', 'r')
+		case '\t':
+			dst = append(dst, '\\', 't')
+		default:
+			dst = append(dst, '\\', 'u', '0', '0',
+				hexDigits[c>>4], hexDigits[c&0xf])
+		}
+		start = i + 1
+	}
+	dst = append(dst, s[start:]...)
+	return append(dst, '"')
+}
@@ -0,0 +1,186 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+import (
+	"bytes"
+	"encoding/hex"
+	"encoding/json"
+	"fmt"
+	"reflect"
+	"strings"
+	"testing"
+)
+
+func TestJSONToCBOR(t *testing.T) {
+	// Expected encodings from RFC 8949 appendix A, where they agree
+	// with the choices made here.
+	cases := []struct{ json, cbor string }{
+		{`0`, "00"},
+		{`23`, "17"},
+		{`24`, "1818"},
+		{`1000`, "1903e8"},
+		{`18446744073709551615`, "1bffffffffffffffff"},
+		{`-1`, "20"},
+		{`-1000`, "3903e7"},
+		{`-18446744073709551616`, "3bffffffffffffffff"},
+		{`1.5`, "fa3fc00000"},
+		{`1.1`, "fb3ff199999999999a"},
+		{`true`, "f5"},
+		{`null`, "f6"},
+		{`""`, "60"},
+		{`"a"`, "6161"},
+		{`"ü"`, "62c3bc"},
+		{`"𐅑"`, "64f0908591"},
+		{`[]`, "80"},
+		{` [1, [2, 3], [4, 5]] `, "8301820203820405"},
+		{`{"a": 1, "b": [2, 3]}`, "a26161016162820203"},
+		{`{"a": {}, "b": [[]]}`, "a26161a0616281" + "80"},
+		{``, ""},
+	}
+	for _, c := range cases {
+		out, err := jsonToCBOR(nil, []byte(c.json))
+		if err != nil {
+			t.Errorf("%s: %s", c.json, err)
+			continue
+		}
+		if got := hex.EncodeToString(out); got != c.cbor {
+			t.Errorf("%s: got %s, want %s", c.json, got, c.cbor)
+		}
+	}
+}
+
+func TestCBORToJSON(t *testing.T) {
+	cases := []struct{ cbor, json string }{
+		{"f93e00", `1.5`},
+		{"f90001", `5.9604645e-08`},
+		{"fa47c35000", `100000`},
+		{"3bffffffffffffffff", `-18446744073709551616`},
+		{"9f018202039f0405ffff", `[1,[2,3],[4,5]]`},
+		{"bf61610161629f0203ffff", `{"a":1,"b":[2,3]}`},
+		{"7f657374726561646d696e67ff", `"streaming"`},
+		{"4401020304", `"AQIDBA=="`},
+		{"6322095c", `"\"\t\\"`},
+		{"", ``},
+	}
+	for _, c := range cases {
+		in, _ := hex.DecodeString(c.cbor)
+		out, err := cborToJSON(nil, in)
+		if err != nil {
+			t.Errorf("%s: %s", c.cbor, err)
+			continue
+		}
+		if string(out) != c.json {
+			t.Errorf("%s: got %s, want %s", c.cbor, out, c.json)
+		}
+	}
+}
+
+func TestTranscodeErrors(t *testing.T) {
+	for _, in := range []string{
+		`{`, `[1,]`, `{"a"}`, `{"a":1,}`, `{1:2}`, `[1 2]`, `01`, `1.`,
+		`-`, `1e`, `"abc`, "\"\x01\"", `"\x"`, `tru`, `[1]]`, `{}x`,
+		strings.Repeat("[", maxNesting+1) + strings.Repeat("]", maxNesting+1),
+	} {
+		if _, err := jsonToCBOR(nil, []byte(in)); err == nil {
+			t.Errorf("json %q: expected an error", in)
+		}
+	}
+	for _, in := range []string{
+		"18", "62c3", "81", "a1", "a10102", "c11a514b67b0", "f7", "fb7ff0000000000000",
+		"1c", "ff", "9f01", "7f4100ff", "0000", "9bffffffffffffffff",
+	} {
+		raw, _ := hex.DecodeString(in)
+		if _, err := cborToJSON(nil, raw); err == nil {
+			t.Errorf("cbor %s: expected an error", in)
+		}
+	}
+}
+
+func TestTranscodeRoundTrip(t *testing.T) {
+	for _, doc := range []string{
+		statsTable(3),
+		`{"a":"x\ny","b":[true,false,null,[null]],"c":-0.25,"d":{"e":{}}}`,
+		`{"vyatta-interfaces-v1:interfaces":{"name":"dp0s3","mtu":1500}}`,
+	} {
+		cbor, err := jsonToCBOR(nil, []byte(doc))
+		if err != nil {
+			t.Fatalf("%s: %s", doc, err)
+		}
+		back, err := cborToJSON(nil, cbor)
+		if err != nil {
+			t.Fatalf("%s: %s", doc, err)
+		}
+		var want, got interface{}
+		json.Unmarshal([]byte(doc), &want)
+		json.Unmarshal(back, &got)
+		if !reflect.DeepEqual(want, got) {
+			t.Errorf("got %s, want %s", back, doc)
+		}
+	}
+}
+
+// statsTable is a document shaped like the large numeric tables of
+// operational state: a list of rows of counters.
+func statsTable(rows int) string {
+	var b bytes.Buffer
+	b.WriteString(`{"vyatta-example-v1:counters":{"row":[`)
+	for i := 0; i < rows; i++ {
+		if i > 0 {
+			b.WriteByte(',')
+		}
+		fmt.Fprintf(&b, `{"index":%d,"packets-in":%d,"packets-out":%d,`+
+			`"bytes-in":%d,"bytes-out":%d,"errors":%d,"utilisation":%g}`,
+			i, i*7919, i*104729, i*1299709, i*15485863, i%13,
+			float64(i%1000)/1000)
+	}
+	b.WriteString(`]}}`)
+	return b.String()
+}
+
+func BenchmarkPayloadEncoding(b *testing.B) {
+	for _, rows := range []int{10, 1000, 100000} {
+		doc := []byte(statsTable(rows))
+		cbor, err := jsonToCBOR(nil, doc)
+		if err != nil {
+			b.Fatal(err)
+		}
+		prefix := fmt.Sprintf("rows=%d/", rows)
+
+		// What a handler consuming JSON has to do with the document,
+		// for comparison.
+		b.Run(prefix+"json-decode", func(b *testing.B) {
+			b.SetBytes(int64(len(doc)))
+			b.ReportMetric(float64(len(doc)), "payload-bytes")
+			for i := 0; i < b.N; i++ {
+				var v interface{}
+				if err := json.Unmarshal(doc, &v); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+		b.Run(prefix+"json-to-cbor", func(b *testing.B) {
+			b.SetBytes(int64(len(doc)))
+			b.ReportMetric(float64(len(cbor)), "payload-bytes")
+			out := make([]byte, 0, len(cbor))
+			for i := 0; i < b.N; i++ {
+				if _, err := jsonToCBOR(out[:0], doc); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+		b.Run(prefix+"cbor-to-json", func(b *testing.B) {
+			b.SetBytes(int64(len(cbor)))
+			b.ReportMetric(float64(len(doc)), "payload-bytes")
+			out := make([]byte, 0, len(doc))
+			for i := 0; i < b.N; i++ {
+				if _, err := cborToJSON(out[:0], cbor); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
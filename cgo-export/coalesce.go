@@ -0,0 +1,214 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+import (
+	"encoding/json"
+	"errors"
+	"strconv"
+	"strings"
+)
+
+/*
+Keyed coalescing keeps one pending notification per key, the key being
+the value found at a JSON pointer (RFC 6901) into the notification, such
+as /name. A newer notification with the same key replaces the pending
+one where it stands, so the queue stays in order of first arrival and
+holds at most one notification per object. A notification without a
+value at the path is never coalesced.
+
+Keys are compared as the raw JSON text of the value, which the bus
+produces consistently for a given value. Only as much of a notification
+is scanned as is needed to find the key.
+*/
+
+var errJSONPath = errors.New("vci: invalid JSON pointer")
+
+type jsonPath []string
+
+// parseJSONPath parses a JSON pointer. Member names carry their module
+// prefix where the notification has one.
+func parseJSONPath(path string) (jsonPath, error) {
+	if path == "" {
+		return jsonPath{}, nil
+	}
+	if path[0] != '/' {
+		return nil, errJSONPath
+	}
+	segs := strings.Split(path[1:], "/")
+	for i, seg := range segs {
+		if strings.IndexByte(seg, '~') < 0 {
+			continue
+		}
+		for j := 0; j < len(seg); j++ {
+			if seg[j] == '~' &&
+				(j+1 == len(seg) || (seg[j+1] != '0' && seg[j+1] != '1')) {
+				return nil, errJSONPath
+			}
+		}
+		segs[i] = strings.NewReplacer("~1", "/", "~0", "~").Replace(seg)
+	}
+	return segs, nil
+}
+
+// key returns the raw text of the value at p in doc.
+func (p jsonPath) key(doc []byte) (string, bool) {
+	s := jsonScanner{src: doc}
+	for _, seg := range p {
+		s.skipSpace()
+		if s.pos == len(s.src) {
+			return "", false
+		}
+		var found bool
+		switch s.src[s.pos] {
+		case '{':
+			found = s.member(seg)
+		case '[':
+			found = s.element(seg)
+		}
+		if !found {
+			return "", false
+		}
+	}
+	s.skipSpace()
+	start := s.pos
+	if !s.skipValue() || s.pos == start {
+		return "", false
+	}
+	return string(doc[start:s.pos]), true
+}
+
+// jsonScanner walks the structure of a document without validating
+// more of it than it has to.
+type jsonScanner struct {
+	src []byte
+	pos int
+}
+
+func (s *jsonScanner) skipSpace() {
+	for s.pos < len(s.src) && isJSONSpace(s.src[s.pos]) {
+		s.pos++
+	}
+}
+
+// next skips space and consumes c if it comes next.
+func (s *jsonScanner) next(c byte) bool {
+	s.skipSpace()
+	if s.pos < len(s.src) && s.src[s.pos] == c {
+		s.pos++
+		return true
+	}
+	return false
+}
+
+// skipString consumes a string, reporting whether it held escapes.
+func (s *jsonScanner) skipString() (escaped, ok bool) {
+	for s.pos++; s.pos < len(s.src); s.pos++ {
+		switch s.src[s.pos] {
+		case '\\':
+			escaped = true
+			s.pos++
+		case '"':
+			s.pos++
+			return escaped, true
+		}
+	}
+	return escaped, false
+}
+
+func (s *jsonScanner) skipValue() bool {
+	if s.pos == len(s.src) {
+		return false
+	}
+	switch s.src[s.pos] {
+	case '"':
+		_, ok := s.skipString()
+		return ok
+	case '{', '[':
+		depth := 0
+		for s.pos < len(s.src) {
+			switch s.src[s.pos] {
+			case '"':
+				if _, ok := s.skipString(); !ok {
+					return false
+				}
+				continue
+			case '{', '[':
+				depth++
+			case '}', ']':
+				depth--
+			}
+			s.pos++
+			if depth == 0 {
+				return true
+			}
+		}
+		return false
+	}
+	for s.pos < len(s.src) {
+		if c := s.src[s.pos]; c == ',' || c == '}' || c == ']' ||
+			isJSONSpace(c) {
+			return true
+		}
+		s.pos++
+	}
+	return true
+}
+
+// member moves to the value of the object member called name.
+func (s *jsonScanner) member(name string) bool {
+	s.pos++
+	if s.next('}') {
+		return false
+	}
+	for {
+		s.skipSpace()
+		if s.pos == len(s.src) || s.src[s.pos] != '"' {
+			return false
+		}
+		start := s.pos
+		escaped, ok := s.skipString()
+		quoted := s.src[start:s.pos]
+		if !ok || !s.next(':') {
+			return false
+		}
+		if escaped {
+			var unquoted string
+			if json.Unmarshal(quoted, &unquoted) == nil && unquoted == name {
+				s.skipSpace()
+				return true
+			}
+		} else if string(quoted[1:len(quoted)-1]) == name {
+			s.skipSpace()
+			return true
+		}
+		s.skipSpace()
+		if !s.skipValue() || !s.next(',') {
+			return false
+		}
+	}
+}
+
+// element moves to the array element whose index is seg.
+func (s *jsonScanner) element(seg string) bool {
+	index, err := strconv.Atoi(seg)
+	if err != nil || index < 0 {
+		return false
+	}
+	s.pos++
+	if s.next(']') {
+		return false
+	}
+	for i := 0; ; i++ {
+		s.skipSpace()
+		if i == index {
+			return true
+		}
+		if !s.skipValue() || !s.next(',') {
+			return false
+		}
+	}
+}
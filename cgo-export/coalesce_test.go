@@ -0,0 +1,91 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+import (
+	"fmt"
+	"reflect"
+	"testing"
+)
+
+func TestJSONPathKey(t *testing.T) {
+	doc := []byte(` {"a": "x", "esc\"aped": 1, "b" : {"c": [true, {"d": "e,}"}]},
+		"vyatta-interfaces-v1:name": "dp0s3", "a/b": null, "n": -1.5e3}`)
+	cases := []struct {
+		path, key string
+		ok        bool
+	}{
+		{"/a", `"x"`, true},
+		{`/esc"aped`, `1`, true},
+		{"/b/c/0", `true`, true},
+		{"/b/c/1/d", `"e,}"`, true},
+		{"/b/c/1", `{"d": "e,}"}`, true},
+		{"/vyatta-interfaces-v1:name", `"dp0s3"`, true},
+		{"/a~1b", `null`, true},
+		{"/n", `-1.5e3`, true},
+		{"/name", ``, false},
+		{"/b/c/2", ``, false},
+		{"/b/c/x", ``, false},
+		{"/a/b", ``, false},
+	}
+	for _, c := range cases {
+		path, err := parseJSONPath(c.path)
+		if err != nil {
+			t.Fatalf("%s: %s", c.path, err)
+		}
+		key, ok := path.key(doc)
+		if key != c.key || ok != c.ok {
+			t.Errorf("%s: got %q %v, want %q %v", c.path, key, ok, c.key, c.ok)
+		}
+	}
+	for _, bad := range []string{"a", "/~", "/~2"} {
+		if _, err := parseJSONPath(bad); err == nil {
+			t.Errorf("%q: expected an error", bad)
+		}
+	}
+	if path, _ := parseJSONPath("/~01"); path[0] != "~1" {
+		t.Errorf("~01: got %q", path[0])
+	}
+}
+
+func TestCoalesceByKey(t *testing.T) {
+	var got []string
+	q := newSubscriptionQueue(func(in encodedString) {
+		got = append(got, string(in))
+	})
+	if err := q.coalesceByKey("/name"); err != nil {
+		t.Fatal(err)
+	}
+	// Hold the drain off so that everything queues up.
+	q.draining = true
+	for i := 0; i < 3; i++ {
+		for _, name := range []string{"dp0s3", "dp0s4", "dp0s5"} {
+			q.enqueue(encodedString(
+				fmt.Sprintf(`{"name":%q,"seq":%d}`, name, i)))
+		}
+		q.enqueue(encodedString(fmt.Sprintf(`{"seq":%d}`, i)))
+	}
+	q.drain()
+	q.draining = true
+	q.enqueue(encodedString(`{"name":"dp0s3","seq":3}`))
+	q.drain()
+
+	want := []string{
+		`{"name":"dp0s3","seq":2}`,
+		`{"name":"dp0s4","seq":2}`,
+		`{"name":"dp0s5","seq":2}`,
+		`{"seq":0}`,
+		`{"seq":1}`,
+		`{"seq":2}`,
+		`{"name":"dp0s3","seq":3}`,
+	}
+	if !reflect.DeepEqual(got, want) {
+		t.Errorf("got %q, want %q", got, want)
+	}
+	if q.coalesced != 6 || len(q.keySeq) != 0 || len(q.seqKey) != 0 {
+		t.Errorf("coalesced %d, %d keys left", q.coalesced, len(q.keySeq))
+	}
+}
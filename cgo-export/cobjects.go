@@ -6,7 +6,14 @@
 package main
 
 import (
+	"bytes"
+	"log"
+	"math"
 	"runtime"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
 	"unsafe"
 
 	"github.com/danos/mgmterror"
@@ -105,6 +112,173 @@ _vci_rpc_meta_free_call(vci_rpc_meta_object *rpc)
 	}
 	rpc->free(rpc->obj);
 }
+
+void
+_vci_subscriber_v2_call(vci_subscriber_object_v2 *sub, void *in, size_t in_len)
+{
+	sub->subscriber(sub->obj, in, in_len);
+}
+
+void
+_vci_subscriber_v2_free_call(vci_subscriber_object_v2 *sub)
+{
+	if (sub->free == NULL) {
+		return;
+	}
+	sub->free(sub->obj);
+}
+
+void
+_vci_batch_subscriber_call(vci_batch_subscriber_object *sub,
+						   vci_payload *in, size_t count)
+{
+	sub->subscriber(sub->obj, in, count);
+}
+
+void
+_vci_batch_subscriber_free_call(vci_batch_subscriber_object *sub)
+{
+	if (sub->free == NULL) {
+		return;
+	}
+	sub->free(sub->obj);
+}
+
+int
+_vci_config_v2_set_call(vci_config_object_v2 *config,
+						void *in, size_t in_len, vci_error *err)
+{
+	return config->set(config->obj, in, in_len, err);
+}
+
+int
+_vci_config_v2_set_delta_call(vci_config_object_v2 *config,
+							  void *delta, size_t delta_len, vci_error *err)
+{
+	return config->set_delta(config->obj, delta, delta_len, err);
+}
+
+int
+_vci_config_v2_check_prepare_call(vci_config_object_v2 *config,
+								  void *in, size_t in_len, void **prepared,
+								  vci_error *err)
+{
+	return config->check_prepare(config->obj, in, in_len, prepared, err);
+}
+
+int
+_vci_config_v2_set_prepared_call(vci_config_object_v2 *config,
+								 void *prepared, vci_error *err)
+{
+	return config->set_prepared(config->obj, prepared, err);
+}
+
+void
+_vci_config_v2_prepared_free_call(vci_config_object_v2 *config,
+								  void *prepared)
+{
+	if (config->prepared_free == NULL) {
+		return;
+	}
+	config->prepared_free(config->obj, prepared);
+}
+
+int
+_vci_config_v2_check_call(vci_config_object_v2 *config,
+						  void *in, size_t in_len, vci_error *err)
+{
+	return config->check(config->obj, in, in_len, err);
+}
+
+void
+_vci_config_v2_get_call(vci_config_object_v2 *config, vci_buf *out)
+{
+	if (config->get != NULL) {
+		config->get(config->obj, out);
+	}
+}
+
+void
+_vci_config_v2_free_call(vci_config_object_v2 *config)
+{
+	if (config->free == NULL) {
+		return;
+	}
+	config->free(config->obj);
+}
+
+void
+_vci_state_v2_get_call(vci_state_object_v2 *state, vci_buf *out)
+{
+	state->get(state->obj, out);
+}
+
+struct vci_state_writer {
+	uint64_t wd;
+};
+
+void
+_vci_state_v2_stream_call(vci_state_object_v2 *state, uint64_t wd)
+{
+	struct vci_state_writer w = { wd };
+	state->stream(state->obj, &w);
+}
+
+void
+_vci_state_v2_free_call(vci_state_object_v2 *state)
+{
+	if (state->free == NULL) {
+		return;
+	}
+	state->free(state->obj);
+}
+
+int
+_vci_rpc_v2_call(vci_rpc_object_v2 *rpc, void *in, size_t in_len,
+				 vci_buf *out, vci_error *err)
+{
+	return rpc->call(rpc->obj, in, in_len, out, err);
+}
+
+int
+_vci_rpc_meta_v2_call(vci_rpc_meta_object_v2 *rpc,
+					  void *meta, size_t meta_len, void *in, size_t in_len,
+					  vci_buf *out, vci_error *err)
+{
+	return rpc->call(rpc->obj, meta, meta_len, in, in_len, out, err);
+}
+
+void
+_vci_rpc_v2_free_call(vci_rpc_object_v2 *rpc)
+{
+	if (rpc->free == NULL) {
+		return;
+	}
+	rpc->free(rpc->obj);
+}
+
+void
+_vci_rpc_meta_v2_free_call(vci_rpc_meta_object_v2 *rpc)
+{
+	if (rpc->free == NULL) {
+		return;
+	}
+	rpc->free(rpc->obj);
+}
+
+void
+_vci_rpccall_callback_call(vci_rpccall_callback cb, void *ctx, int rc,
+						   void *out, size_t out_len, vci_error *err)
+{
+	cb(ctx, rc, out, out_len, err);
+}
+
+int
+_vci_chunk_reader_call(vci_chunk_reader reader, void *ctx,
+					   void *data, size_t len)
+{
+	return reader(ctx, data, len);
+}
 */
 import "C"
 
@@ -146,11 +320,267 @@ func cSubscriber(sub *C.vci_subscriber_object) func(encodedString) {
 	}
 }
 
+// cPayload exposes the bytes of in to C for the duration of a call. The
+// backing array holds no Go pointers so it may be handed over directly
+// rather than being copied into a C string.
+func cPayload(in encodedString) (unsafe.Pointer, C.size_t) {
+	if len(in) == 0 {
+		return nil, 0
+	}
+	return unsafe.Pointer(&in[0]), C.size_t(len(in))
+}
+
+// goStringN copies a (pointer, length) pair produced by C into a Go
+// string. C.GoStringN takes an int length, so a longer payload is copied
+// in chunks rather than truncated.
+func goStringN(data unsafe.Pointer, len C.size_t) string {
+	if len <= math.MaxInt32 {
+		return C.GoStringN((*C.char)(data), C.int(len))
+	}
+	var b strings.Builder
+	b.Grow(int(len))
+	for len > 0 {
+		n := len
+		if n > maxCWriteChunk {
+			n = maxCWriteChunk
+		}
+		b.Write((*[maxCWriteChunk]byte)(data)[:n:n])
+		data = unsafe.Pointer(uintptr(data) + uintptr(n))
+		len -= n
+	}
+	return b.String()
+}
+
+// goPayload copies a (pointer, length) pair produced by C into Go memory,
+// in chunks as for goStringN if it is too long for C.GoBytes.
+func goPayload(data unsafe.Pointer, len C.size_t) encodedString {
+	if len <= math.MaxInt32 {
+		return encodedString(C.GoBytes(data, C.int(len)))
+	}
+	out := make(encodedString, 0, int(len))
+	for len > 0 {
+		n := len
+		if n > maxCWriteChunk {
+			n = maxCWriteChunk
+		}
+		out = append(out, (*[maxCWriteChunk]byte)(data)[:n:n]...)
+		data = unsafe.Pointer(uintptr(data) + uintptr(n))
+		len -= n
+	}
+	return out
+}
+
+// Bounds for viewing C arrays as Go slices, kept small enough for the
+// array types to be valid on 32 bit targets.
+const (
+	maxCPayloads   = 1 << 26
+	maxCRPCResults = 1 << 24
+)
+
+func cPayloads(p *C.vci_payload, n C.size_t) []C.vci_payload {
+	if n == 0 {
+		return nil
+	}
+	return (*[maxCPayloads]C.vci_payload)(unsafe.Pointer(p))[:n:n]
+}
+
+func cRPCResults(p *C.vci_rpc_result, n C.size_t) []C.vci_rpc_result {
+	if n == 0 {
+		return nil
+	}
+	return (*[maxCRPCResults]C.vci_rpc_result)(unsafe.Pointer(p))[:n:n]
+}
+
+// stringPayload exposes the bytes of s to C for the duration of a call
+// without copying them, as unsafe.StringData would on a newer toolchain.
+// A string followed by an int has the layout of a slice header with
+// length and capacity len(s), so the conversion views s's own bytes. The
+// pointer is only held as an unsafe.Pointer, never a uintptr, so s stays
+// reachable until C returns. String data holds no Go pointers, so cgo
+// allows passing it, and C receives it as const and must not keep it, so
+// s is neither modified nor used after the call.
+func stringPayload(s string) (unsafe.Pointer, C.size_t) {
+	if len(s) == 0 {
+		return nil, 0
+	}
+	b := *(*[]byte)(unsafe.Pointer(&struct {
+		string
+		int
+	}{s, len(s)}))
+	return unsafe.Pointer(&b[0]), C.size_t(len(s))
+}
+
+// cOutput hands a result back to a _v2 caller. C.CString already copies
+// by length, the terminator it appends is a convenience for C callers.
+func cOutput(out string) (unsafe.Pointer, C.size_t) {
+	return unsafe.Pointer(C.CString(out)), C.size_t(len(out))
+}
+
+// The piece size used by the _read_ client calls when none is given.
+const defaultReadChunk = 64 << 10
+
+// readChunks hands out to reader in pieces of at most chunkSize bytes,
+// taken straight from out.
+func readChunks(
+	out string, chunkSize C.size_t,
+	reader C.vci_chunk_reader, ctx unsafe.Pointer,
+) C.int {
+	if chunkSize == 0 {
+		chunkSize = defaultReadChunk
+	}
+	for len(out) > 0 {
+		n := len(out)
+		if uint64(n) > uint64(chunkSize) {
+			n = int(chunkSize)
+		}
+		data, _ := stringPayload(out)
+		rc := C._vci_chunk_reader_call(reader, ctx, data, C.size_t(n))
+		if rc != 0 {
+			return rc
+		}
+		out = out[n:]
+	}
+	return 0
+}
+
+func cSubscriberV2(sub *C.vci_subscriber_object_v2) func(encodedString) {
+	subCpy := *sub
+	runtime.SetFinalizer(&subCpy, func(sub *C.vci_subscriber_object_v2) {
+		C._vci_subscriber_v2_free_call(sub)
+	})
+	return func(in encodedString) {
+		cin, cinLen := cPayload(in)
+		C._vci_subscriber_v2_call(&subCpy, cin, cinLen)
+	}
+}
+
+// cBatch is the C memory a batch is handed over in: an array of payloads
+// whose contents lie back to back in one buffer. Go memory cannot be
+// referenced from C memory, so the notifications are copied, but both
+// allocations are reused from batch to batch.
+type cBatch struct {
+	payloads   *C.vci_payload
+	payloadCap int
+	data       unsafe.Pointer
+	dataCap    uintptr
+}
+
+func newCBatch() *cBatch {
+	b := &cBatch{}
+	runtime.SetFinalizer(b, func(b *cBatch) {
+		C.free(unsafe.Pointer(b.payloads))
+		C.free(b.data)
+	})
+	return b
+}
+
+// fill lays batch out in C memory, returning nil if it cannot allocate.
+func (b *cBatch) fill(batch []encodedString) []C.vci_payload {
+	var size uintptr
+	for _, in := range batch {
+		size += uintptr(len(in))
+	}
+	if size > b.dataCap {
+		data := C.realloc(b.data, C.size_t(size))
+		if data == nil {
+			return nil
+		}
+		b.data, b.dataCap = data, size
+	}
+	if len(batch) > b.payloadCap {
+		payloads := C.realloc(unsafe.Pointer(b.payloads),
+			C.size_t(len(batch))*C.sizeof_vci_payload)
+		if payloads == nil {
+			return nil
+		}
+		b.payloads, b.payloadCap = (*C.vci_payload)(payloads), len(batch)
+	}
+	out := cPayloads(b.payloads, C.size_t(len(batch)))
+	off := uintptr(0)
+	for i, in := range batch {
+		dst := unsafe.Pointer(uintptr(b.data) + off)
+		for rest := []byte(in); len(rest) > 0; {
+			n := len(rest)
+			if n > maxCWriteChunk {
+				n = maxCWriteChunk
+			}
+			copy(cBytes(dst, C.size_t(n)), rest[:n])
+			dst = unsafe.Pointer(uintptr(dst) + uintptr(n))
+			rest = rest[n:]
+		}
+		out[i].data = unsafe.Pointer(uintptr(b.data) + off)
+		out[i].len = C.size_t(len(in))
+		off += uintptr(len(in))
+	}
+	return out
+}
+
+// cBatchSubscriber returns a batch subscriber that reports how many of a
+// batch it could not deliver. A batch too big to allocate is delivered one
+// notification at a time instead, and only those that cannot be copied
+// even on their own are lost.
+func cBatchSubscriber(sub *C.vci_batch_subscriber_object) func([]encodedString) int {
+	subCpy := *sub
+	runtime.SetFinalizer(&subCpy, func(sub *C.vci_batch_subscriber_object) {
+		C._vci_batch_subscriber_free_call(sub)
+	})
+	// Batches are delivered one at a time, so one buffer will do.
+	buf := newCBatch()
+	call := func(payloads []C.vci_payload) {
+		C._vci_batch_subscriber_call(&subCpy, &payloads[0],
+			C.size_t(len(payloads)))
+	}
+	return func(batch []encodedString) int {
+		if payloads := buf.fill(batch); payloads != nil {
+			call(payloads)
+			return 0
+		}
+		lost := 0
+		for i := range batch {
+			payloads := buf.fill(batch[i : i+1])
+			if payloads == nil {
+				lost++
+				continue
+			}
+			call(payloads)
+		}
+		return lost
+	}
+}
+
+// completeRPCCall waits for the reply to an asynchronous call and hands
+// it to the caller's completion callback. Waiting only parks a goroutine,
+// so any number of calls may be outstanding.
+func completeRPCCall(
+	rpccall *clientCall,
+	cb C.vci_rpccall_callback,
+	ctx unsafe.Pointer,
+) {
+	var out string
+	var cerr C.vci_error
+	_vci_error_init(&cerr)
+	defer _vci_error_free(&cerr)
+	err := rpccall.StoreOutputInto(&out)
+	if err != nil {
+		error_to_vci_error(err, &cerr)
+		C._vci_rpccall_callback_call(cb, ctx, -1, nil, 0, &cerr)
+		return
+	}
+	cout, coutLen := stringPayload(out)
+	C._vci_rpccall_callback_call(cb, ctx, 0, cout, coutLen, &cerr)
+}
+
 type cconfig struct {
 	cobj *C.vci_config_object
+	gate *admissionGate
 }
 
 func (conf *cconfig) Set(in encodedString) error {
+	tracked, err := conf.gate.enter(true)
+	if err != nil {
+		return err
+	}
+	defer conf.gate.exit(tracked)
 	cin := C.CString(string(in))
 	defer C.free(unsafe.Pointer(cin))
 	var cerr C.vci_error
@@ -164,6 +594,11 @@ func (conf *cconfig) Set(in encodedString) error {
 }
 
 func (conf *cconfig) Check(in encodedString) error {
+	tracked, err := conf.gate.enter(true)
+	if err != nil {
+		return err
+	}
+	defer conf.gate.exit(tracked)
 	cin := C.CString(string(in))
 	defer C.free(unsafe.Pointer(cin))
 	var cerr C.vci_error
@@ -177,6 +612,8 @@ func (conf *cconfig) Check(in encodedString) error {
 }
 
 func (conf *cconfig) Get() encodedString {
+	tracked, _ := conf.gate.enter(false)
+	defer conf.gate.exit(tracked)
 	var cout *C.char
 	defer func() { C.free(unsafe.Pointer(cout)) }()
 	C._vci_config_get_call(conf.cobj, &cout)
@@ -187,20 +624,304 @@ func (conf *cconfig) free() {
 	C._vci_config_free_call(conf.cobj)
 }
 
-func cConfig(cobj *C.vci_config_object) *cconfig {
+func cConfig(cobj *C.vci_config_object, gate *admissionGate) *cconfig {
 	tmp := *cobj
-	out := &cconfig{cobj: &tmp}
+	out := &cconfig{cobj: &tmp, gate: gate}
 	runtime.SetFinalizer(out, func(conf *cconfig) {
 		conf.free()
 	})
 	return out
 }
 
+// getCache keeps the last document a _v2 get produced for as long as the
+// object's generation counter, and the number of successful sets, stay
+// the same. Objects without a generation counter are not cached, nor is
+// a document that could not be fetched.
+type getCache struct {
+	generation *C.uint64_t
+	sets       uint64
+
+	mu        sync.Mutex
+	valid     bool
+	cachedGen uint64
+	cachedSet uint64
+	doc       encodedString
+}
+
+func newGetCache(generation *C.uint64_t) *getCache {
+	if generation == nil {
+		return nil
+	}
+	return &getCache{generation: generation}
+}
+
+func (c *getCache) get(fetch func() (encodedString, bool)) encodedString {
+	if c == nil {
+		doc, _ := fetch()
+		return doc
+	}
+	// Read the versions before fetching so a change made during the
+	// fetch is never attributed to the old document.
+	gen := atomic.LoadUint64((*uint64)(unsafe.Pointer(c.generation)))
+	sets := atomic.LoadUint64(&c.sets)
+	c.mu.Lock()
+	if c.valid && c.cachedGen == gen && c.cachedSet == sets {
+		doc := c.doc
+		c.mu.Unlock()
+		return doc
+	}
+	c.mu.Unlock()
+	doc, ok := fetch()
+	if !ok {
+		return doc
+	}
+	c.mu.Lock()
+	c.valid, c.cachedGen, c.cachedSet, c.doc = true, gen, sets, doc
+	c.mu.Unlock()
+	return doc
+}
+
+func (c *getCache) invalidate() {
+	if c != nil {
+		atomic.AddUint64(&c.sets, 1)
+	}
+}
+
+type cconfigV2 struct {
+	cobj  *C.vci_config_object_v2
+	cache *getCache
+	enc   payloadEncoding
+	gate  *admissionGate
+
+	// The document last applied through set_delta, decoded. resync is
+	// set when that could not be kept current, the next set is then
+	// passed in full.
+	deltaMu sync.Mutex
+	applied interface{}
+	resync  bool
+
+	// The token check_prepare returned for the document in prepDoc.
+	prepMu      sync.Mutex
+	prepDoc     encodedString
+	prepared    unsafe.Pointer
+	hasPrepared bool
+}
+
+func (conf *cconfigV2) Set(in encodedString) error {
+	tracked, err := conf.gate.enter(true)
+	if err != nil {
+		return err
+	}
+	defer conf.gate.exit(tracked)
+	if prepared, ok := conf.takePrepared(in); ok {
+		return conf.setPrepared(in, prepared)
+	}
+	if conf.cobj.set_delta != nil && !conf.resyncing() {
+		return conf.setDelta(in)
+	}
+	doc, err := conf.enc.toC(in)
+	if err != nil {
+		return encodingError(err)
+	}
+	cin, cinLen := cPayload(doc)
+	var cerr C.vci_error
+	_vci_error_init(&cerr)
+	defer _vci_error_free(&cerr)
+	rc := C._vci_config_v2_set_call(conf.cobj, cin, cinLen, &cerr)
+	if rc != 0 {
+		return vci_error_to_error(&cerr)
+	}
+	if conf.cobj.set_delta != nil {
+		conf.setApplied(in)
+	}
+	conf.cache.invalidate()
+	return nil
+}
+
+func (conf *cconfigV2) resyncing() bool {
+	conf.deltaMu.Lock()
+	defer conf.deltaMu.Unlock()
+	return conf.resync
+}
+
+// setApplied makes in, applied other than through set_delta, the base of
+// the next delta. If it cannot be decoded the base is dropped and the
+// next set is passed in full instead.
+func (conf *cconfigV2) setApplied(in encodedString) {
+	doc, err := decodeConfig(in)
+	conf.deltaMu.Lock()
+	defer conf.deltaMu.Unlock()
+	if err != nil {
+		log.Printf("vci: config delta base: %s", err)
+		conf.applied, conf.resync = nil, true
+		return
+	}
+	conf.applied, conf.resync = doc, false
+}
+
+// takePrepared hands over the token prepared for in, if there is one. A
+// token prepared for any other document belonged to a commit that never
+// reached set and is released.
+func (conf *cconfigV2) takePrepared(in encodedString) (unsafe.Pointer, bool) {
+	conf.prepMu.Lock()
+	defer conf.prepMu.Unlock()
+	if !conf.hasPrepared {
+		return nil, false
+	}
+	prepared, doc := conf.prepared, conf.prepDoc
+	conf.prepared, conf.prepDoc, conf.hasPrepared = nil, nil, false
+	if !bytes.Equal(doc, in) {
+		C._vci_config_v2_prepared_free_call(conf.cobj, prepared)
+		return nil, false
+	}
+	return prepared, true
+}
+
+func (conf *cconfigV2) setPrepared(in encodedString, prepared unsafe.Pointer) error {
+	defer C._vci_config_v2_prepared_free_call(conf.cobj, prepared)
+	var cerr C.vci_error
+	_vci_error_init(&cerr)
+	defer _vci_error_free(&cerr)
+	rc := C._vci_config_v2_set_prepared_call(conf.cobj, prepared, &cerr)
+	if rc != 0 {
+		return vci_error_to_error(&cerr)
+	}
+	if conf.cobj.set_delta != nil {
+		conf.setApplied(in)
+	}
+	conf.cache.invalidate()
+	return nil
+}
+
+func (conf *cconfigV2) checkPrepare(in encodedString) error {
+	doc, err := conf.enc.toC(in)
+	if err != nil {
+		return encodingError(err)
+	}
+	cin, cinLen := cPayload(doc)
+	var prepared unsafe.Pointer
+	var cerr C.vci_error
+	_vci_error_init(&cerr)
+	defer _vci_error_free(&cerr)
+	rc := C._vci_config_v2_check_prepare_call(conf.cobj, cin, cinLen,
+		&prepared, &cerr)
+	conf.prepMu.Lock()
+	defer conf.prepMu.Unlock()
+	if conf.hasPrepared {
+		C._vci_config_v2_prepared_free_call(conf.cobj, conf.prepared)
+		conf.prepared, conf.prepDoc, conf.hasPrepared = nil, nil, false
+	}
+	if rc != 0 {
+		return vci_error_to_error(&cerr)
+	}
+	conf.prepared, conf.hasPrepared = prepared, true
+	conf.prepDoc = append(encodedString(nil), in...)
+	return nil
+}
+
+func (conf *cconfigV2) setDelta(in encodedString) error {
+	doc, err := decodeConfig(in)
+	if err != nil {
+		return err
+	}
+	conf.deltaMu.Lock()
+	defer conf.deltaMu.Unlock()
+	if conf.applied == nil {
+		conf.applied = map[string]interface{}{}
+	}
+	delta, err := computeConfigDelta(conf.applied, doc)
+	if err != nil {
+		return err
+	}
+	if delta, err = conf.enc.toC(delta); err != nil {
+		return encodingError(err)
+	}
+	cdelta, cdeltaLen := cPayload(delta)
+	var cerr C.vci_error
+	_vci_error_init(&cerr)
+	defer _vci_error_free(&cerr)
+	rc := C._vci_config_v2_set_delta_call(conf.cobj, cdelta, cdeltaLen, &cerr)
+	if rc != 0 {
+		return vci_error_to_error(&cerr)
+	}
+	conf.applied = doc
+	conf.cache.invalidate()
+	return nil
+}
+
+func (conf *cconfigV2) Check(in encodedString) error {
+	tracked, err := conf.gate.enter(true)
+	if err != nil {
+		return err
+	}
+	defer conf.gate.exit(tracked)
+	if conf.cobj.check_prepare != nil {
+		return conf.checkPrepare(in)
+	}
+	doc, err := conf.enc.toC(in)
+	if err != nil {
+		return encodingError(err)
+	}
+	cin, cinLen := cPayload(doc)
+	var cerr C.vci_error
+	_vci_error_init(&cerr)
+	defer _vci_error_free(&cerr)
+	rc := C._vci_config_v2_check_call(conf.cobj, cin, cinLen, &cerr)
+	if rc != 0 {
+		return vci_error_to_error(&cerr)
+	}
+	return nil
+}
+
+func (conf *cconfigV2) Get() encodedString {
+	return conf.cache.get(func() (encodedString, bool) {
+		tracked, _ := conf.gate.enter(false)
+		defer conf.gate.exit(tracked)
+		out := getCBuf()
+		defer out.release()
+		C._vci_config_v2_get_call(conf.cobj, out.buf)
+		doc, err := conf.enc.fromCBuf(out)
+		if err != nil {
+			log.Printf("vci: config get: %s", err)
+			return encodedString(""), false
+		}
+		return doc, true
+	})
+}
+
+func (conf *cconfigV2) free() {
+	if conf.hasPrepared {
+		C._vci_config_v2_prepared_free_call(conf.cobj, conf.prepared)
+	}
+	C._vci_config_v2_free_call(conf.cobj)
+}
+
+func cConfigV2(
+	cobj *C.vci_config_object_v2,
+	enc payloadEncoding,
+	gate *admissionGate,
+) *cconfigV2 {
+	tmp := *cobj
+	out := &cconfigV2{
+		cobj:  &tmp,
+		cache: newGetCache(tmp.generation),
+		enc:   enc,
+		gate:  gate,
+	}
+	runtime.SetFinalizer(out, func(conf *cconfigV2) {
+		conf.free()
+	})
+	return out
+}
+
 type cstate struct {
 	cobj *C.vci_state_object
+	gate *admissionGate
 }
 
 func (state *cstate) Get() encodedString {
+	tracked, _ := state.gate.enter(false)
+	defer state.gate.exit(tracked)
 	var cout *C.char
 	defer func() { C.free(unsafe.Pointer(cout)) }()
 	C._vci_state_get_call(state.cobj, &cout)
@@ -211,24 +932,129 @@ func (state *cstate) free() {
 	C._vci_state_free_call(state.cobj)
 }
 
-func cState(cobj *C.vci_state_object) *cstate {
+func cState(cobj *C.vci_state_object, gate *admissionGate) *cstate {
 	tmp := *cobj
-	out := &cstate{cobj: &tmp}
+	out := &cstate{cobj: &tmp, gate: gate}
 	runtime.SetFinalizer(out, func(state *cstate) {
 		state.free()
 	})
 	return out
 }
 
+type cstateV2 struct {
+	cobj  *C.vci_state_object_v2
+	cache *getCache
+	enc   payloadEncoding
+	gate  *admissionGate
+}
+
+func (state *cstateV2) Get() encodedString {
+	return state.cache.get(func() (encodedString, bool) {
+		tracked, _ := state.gate.enter(false)
+		defer state.gate.exit(tracked)
+		if state.cobj.stream != nil {
+			return state.getStream()
+		}
+		out := getCBuf()
+		defer out.release()
+		C._vci_state_v2_get_call(state.cobj, out.buf)
+		doc, err := state.enc.fromCBuf(out)
+		if err != nil {
+			log.Printf("vci: state get: %s", err)
+			return encodedString(""), false
+		}
+		return doc, true
+	})
+}
+
+// getStream collects a streamed document straight into Go memory, through
+// a writer that is only valid for the duration of the call.
+func (state *cstateV2) getStream() (encodedString, bool) {
+	w := &stateWriter{}
+	wd := stateWriters.Register(w)
+	defer stateWriters.Unregister(wd)
+	C._vci_state_v2_stream_call(state.cobj, C.uint64_t(wd))
+	if w.failed {
+		log.Printf("vci: state stream: handler failed")
+		return encodedString(""), false
+	}
+	doc, err := state.enc.fromC(w.doc)
+	if err != nil {
+		log.Printf("vci: state stream: %s", err)
+		return encodedString(""), false
+	}
+	return doc, true
+}
+
+func (state *cstateV2) free() {
+	C._vci_state_v2_free_call(state.cobj)
+}
+
+func cStateV2(
+	cobj *C.vci_state_object_v2,
+	enc payloadEncoding,
+	gate *admissionGate,
+) *cstateV2 {
+	tmp := *cobj
+	out := &cstateV2{
+		cobj:  &tmp,
+		cache: newGetCache(tmp.generation),
+		enc:   enc,
+		gate:  gate,
+	}
+	runtime.SetFinalizer(out, func(state *cstateV2) {
+		state.free()
+	})
+	return out
+}
+
+// component remembers the name it was created with, which the vci package
+// does not expose.
+type component struct {
+	vci.Component
+	name string
+
+	mu       sync.Mutex
+	executor *executor
+	ringSize int
+}
+
+func (c *component) setExecutor(e *executor, ringSize int) {
+	c.mu.Lock()
+	c.executor, c.ringSize = e, ringSize
+	c.mu.Unlock()
+}
+
+// subscriber returns what to subscribe for deliver: deliver itself, or
+// with an executor set a queue that hands notifications to it.
+func (c *component) subscriber(deliver func(encodedString)) func(encodedString) {
+	c.mu.Lock()
+	e, ringSize := c.executor, c.ringSize
+	c.mu.Unlock()
+	if e == nil {
+		return deliver
+	}
+	q := newSubscriptionQueue(deliver)
+	q.setExecutor(e, ringSize)
+	return q.enqueue
+}
+
 type model struct {
 	vci.Model
-	rpcs map[string]*crpc
+	component string
+	name      string
+	rpcs      map[string]*crpc
+	encoding  payloadEncoding
+	gate      *admissionGate
 }
 
-func newModel(mod vci.Model) *model {
+func newModel(component, name string, mod vci.Model) *model {
 	return &model{
-		Model: mod,
-		rpcs:  make(map[string]*crpc),
+		Model:     mod,
+		component: component,
+		name:      name,
+		rpcs:      make(map[string]*crpc),
+		gate:      modelGate(component, name),
 	}
 }
 
@@ -238,7 +1064,7 @@ func (m *model) addRPC(moduleName, rpcName string, crpc_obj *C.vci_rpc_object) {
 		m.rpcs[moduleName] = cRPC()
 		crpc = m.rpcs[moduleName]
 	}
-	crpc.addRPC(rpcName, crpc_obj)
+	crpc.addRPC(rpcName, crpc_obj, m.handler(moduleName, rpcName))
 }
 
 func (m *model) addMetaRPC(moduleName, rpcName string, crpc_obj *C.vci_rpc_meta_object) {
@@ -247,7 +1073,43 @@ func (m *model) addMetaRPC(moduleName, rpcName string, crpc_obj *C.vci_rpc_meta_
 		m.rpcs[moduleName] = cRPC()
 		crpc = m.rpcs[moduleName]
 	}
-	crpc.addMetaRPC(rpcName, crpc_obj)
+	crpc.addMetaRPC(rpcName, crpc_obj, m.handler(moduleName, rpcName))
+}
+
+func (m *model) addRPCV2(moduleName, rpcName string, crpc_obj *C.vci_rpc_object_v2) {
+	crpc, ok := m.rpcs[moduleName]
+	if !ok {
+		m.rpcs[moduleName] = cRPC()
+		crpc = m.rpcs[moduleName]
+	}
+	crpc.addRPCV2(rpcName, crpc_obj, m.handler(moduleName, rpcName))
+}
+
+func (m *model) addMetaRPCV2(moduleName, rpcName string, crpc_obj *C.vci_rpc_meta_object_v2) {
+	crpc, ok := m.rpcs[moduleName]
+	if !ok {
+		m.rpcs[moduleName] = cRPC()
+		crpc = m.rpcs[moduleName]
+	}
+	crpc.addMetaRPCV2(rpcName, crpc_obj, m.handler(moduleName, rpcName))
+}
+
+// rpcHandler is what a handler of an RPC needs to know about it.
+type rpcHandler struct {
+	stats     *rpcStats
+	enc       payloadEncoding
+	admission admission
+}
+
+func (m *model) handler(moduleName, rpcName string) rpcHandler {
+	return rpcHandler{
+		stats: handlerStats(m, moduleName, rpcName),
+		enc:   m.encoding,
+		admission: admission{
+			rpc:   rpcGate(m, moduleName, rpcName),
+			model: m.gate,
+		},
+	}
 }
 
 func (m *model) getModuleRPCs(moduleName string) *crpc {
@@ -264,12 +1126,18 @@ func cRPC() *crpc {
 	}
 }
 
-func (rpc *crpc) addRPC(name string, cRPC *C.vci_rpc_object) {
+func (rpc *crpc) addRPC(name string, cRPC *C.vci_rpc_object, h rpcHandler) {
 	rpcCpy := *cRPC
 	runtime.SetFinalizer(&rpcCpy, func(rpc *C.vci_rpc_object) {
 		C._vci_rpc_free_call(rpc)
 	})
 	rpc.rpcs[name] = func(in encodedString) (encodedString, error) {
+		ticket, err := h.admission.enter(true)
+		if err != nil {
+			return encodedString(""), err
+		}
+		defer h.admission.exit(ticket)
+		start := time.Now()
 		cin := C.CString(string(in))
 		defer C.free(unsafe.Pointer(cin))
 		var cout *C.char
@@ -279,18 +1147,27 @@ func (rpc *crpc) addRPC(name string, cRPC *C.vci_rpc_object) {
 		defer _vci_error_free(&cerr)
 		rc := C._vci_rpc_call(&rpcCpy, cin, &cout, &cerr)
 		if rc != 0 {
+			h.stats.record(start, len(in), 0, true)
 			return encodedString(""), vci_error_to_error(&cerr)
 		}
-		return encodedString(C.GoString(cout)), nil
+		out := encodedString(C.GoString(cout))
+		h.stats.record(start, len(in), len(out), false)
+		return out, nil
 	}
 }
 
-func (rpc *crpc) addMetaRPC(name string, cRPC *C.vci_rpc_meta_object) {
+func (rpc *crpc) addMetaRPC(name string, cRPC *C.vci_rpc_meta_object, h rpcHandler) {
 	rpcCpy := *cRPC
 	runtime.SetFinalizer(&rpcCpy, func(rpc *C.vci_rpc_meta_object) {
 		C._vci_rpc_meta_free_call(rpc)
 	})
 	rpc.rpcs[name] = func(meta, in encodedString) (encodedString, error) {
+		ticket, err := h.admission.enter(true)
+		if err != nil {
+			return encodedString(""), err
+		}
+		defer h.admission.exit(ticket)
+		start := time.Now()
 		cmeta := C.CString(string(meta))
 		defer C.free(unsafe.Pointer(cmeta))
 		cin := C.CString(string(in))
@@ -302,9 +1179,103 @@ func (rpc *crpc) addMetaRPC(name string, cRPC *C.vci_rpc_meta_object) {
 		defer _vci_error_free(&cerr)
 		rc := C._vci_rpc_meta_call(&rpcCpy, cmeta, cin, &cout, &cerr)
 		if rc != 0 {
+			h.stats.record(start, len(in), 0, true)
+			return encodedString(""), vci_error_to_error(&cerr)
+		}
+		out := encodedString(C.GoString(cout))
+		h.stats.record(start, len(in), len(out), false)
+		return out, nil
+	}
+}
+
+func (rpc *crpc) addRPCV2(
+	name string,
+	cRPC *C.vci_rpc_object_v2,
+	h rpcHandler,
+) {
+	rpcCpy := *cRPC
+	runtime.SetFinalizer(&rpcCpy, func(rpc *C.vci_rpc_object_v2) {
+		C._vci_rpc_v2_free_call(rpc)
+	})
+	rpc.rpcs[name] = func(in encodedString) (encodedString, error) {
+		ticket, err := h.admission.enter(true)
+		if err != nil {
+			return encodedString(""), err
+		}
+		defer h.admission.exit(ticket)
+		start := time.Now()
+		cdoc, err := h.enc.toC(in)
+		if err != nil {
+			h.stats.record(start, len(in), 0, true)
+			return encodedString(""), encodingError(err)
+		}
+		cin, cinLen := cPayload(cdoc)
+		out := getCBuf()
+		defer out.release()
+		var cerr C.vci_error
+		_vci_error_init(&cerr)
+		defer _vci_error_free(&cerr)
+		rc := C._vci_rpc_v2_call(&rpcCpy, cin, cinLen, out.buf, &cerr)
+		if rc != 0 {
+			h.stats.record(start, len(in), 0, true)
 			return encodedString(""), vci_error_to_error(&cerr)
 		}
-		return encodedString(C.GoString(cout)), nil
+		output, err := h.enc.fromCBuf(out)
+		if err != nil {
+			h.stats.record(start, len(in), 0, true)
+			return encodedString(""), encodingError(err)
+		}
+		h.stats.record(start, len(in), len(output), false)
+		return output, nil
+	}
+}
+
+func (rpc *crpc) addMetaRPCV2(
+	name string,
+	cRPC *C.vci_rpc_meta_object_v2,
+	h rpcHandler,
+) {
+	rpcCpy := *cRPC
+	runtime.SetFinalizer(&rpcCpy, func(rpc *C.vci_rpc_meta_object_v2) {
+		C._vci_rpc_meta_v2_free_call(rpc)
+	})
+	rpc.rpcs[name] = func(meta, in encodedString) (encodedString, error) {
+		ticket, err := h.admission.enter(true)
+		if err != nil {
+			return encodedString(""), err
+		}
+		defer h.admission.exit(ticket)
+		start := time.Now()
+		cmetaDoc, err := h.enc.toC(meta)
+		if err != nil {
+			h.stats.record(start, len(in), 0, true)
+			return encodedString(""), encodingError(err)
+		}
+		cdoc, err := h.enc.toC(in)
+		if err != nil {
+			h.stats.record(start, len(in), 0, true)
+			return encodedString(""), encodingError(err)
+		}
+		cmeta, cmetaLen := cPayload(cmetaDoc)
+		cin, cinLen := cPayload(cdoc)
+		out := getCBuf()
+		defer out.release()
+		var cerr C.vci_error
+		_vci_error_init(&cerr)
+		defer _vci_error_free(&cerr)
+		rc := C._vci_rpc_meta_v2_call(&rpcCpy, cmeta, cmetaLen, cin, cinLen,
+			out.buf, &cerr)
+		if rc != 0 {
+			h.stats.record(start, len(in), 0, true)
+			return encodedString(""), vci_error_to_error(&cerr)
+		}
+		output, err := h.enc.fromCBuf(out)
+		if err != nil {
+			h.stats.record(start, len(in), 0, true)
+			return encodedString(""), encodingError(err)
+		}
+		h.stats.record(start, len(in), len(output), false)
+		return output, nil
 	}
 }
 
@@ -0,0 +1,193 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+import (
+	"bytes"
+	"encoding/json"
+)
+
+/*
+Config objects with a set_delta callback are handed the difference
+between the document being applied and the one applied before it:
+
+	{"added": {...}, "changed": {...}, "removed": {...}}
+
+Each member mirrors the shape of the configuration and holds only the
+affected subtrees. "added" has the new values of members that did not
+exist before, "changed" the new values of leaves whose value changed and
+"removed" the old values of members that no longer exist. Lists are
+matched element by element without knowledge of their keys, so an entry
+whose contents changed shows up as its old value in "removed" and its
+new value in "added", as does a member whose value was replaced by one
+of another kind, such as an object by a leaf. A null is a value like any
+other.
+*/
+
+type configDelta struct {
+	Added   interface{} `json:"added"`
+	Changed interface{} `json:"changed"`
+	Removed interface{} `json:"removed"`
+}
+
+func decodeConfig(doc encodedString) (interface{}, error) {
+	if len(bytes.TrimSpace(doc)) == 0 {
+		return map[string]interface{}{}, nil
+	}
+	dec := json.NewDecoder(bytes.NewReader(doc))
+	dec.UseNumber()
+	var v interface{}
+	if err := dec.Decode(&v); err != nil {
+		return nil, err
+	}
+	return v, nil
+}
+
+// computeConfigDelta returns the encoded delta taking old to new.
+func computeConfigDelta(old, new interface{}) (encodedString, error) {
+	added, changed, removed := diffConfig(old, new)
+	delta := configDelta{
+		Added:   added.orEmpty(),
+		Changed: changed.orEmpty(),
+		Removed: removed.orEmpty(),
+	}
+	return json.Marshal(&delta)
+}
+
+// subtree is one part of a difference. A null value is a value like any
+// other, so whether there is anything to report is kept apart from it.
+type subtree struct {
+	value   interface{}
+	present bool
+}
+
+func some(v interface{}) subtree {
+	return subtree{value: v, present: true}
+}
+
+func (t subtree) orEmpty() interface{} {
+	if !t.present {
+		return map[string]interface{}{}
+	}
+	return t.value
+}
+
+func isContainer(v interface{}) bool {
+	switch v.(type) {
+	case map[string]interface{}, []interface{}:
+		return true
+	}
+	return false
+}
+
+// diffConfig compares two decoded documents. A leaf whose value changed
+// is reported in changed. A value replaced by one of another kind, such
+// as an object by a leaf, is reported as its old value removed and its
+// new value added.
+func diffConfig(old, new interface{}) (added, changed, removed subtree) {
+	switch n := new.(type) {
+	case map[string]interface{}:
+		if o, ok := old.(map[string]interface{}); ok {
+			return diffObjects(o, n)
+		}
+	case []interface{}:
+		if o, ok := old.([]interface{}); ok {
+			return diffLists(o, n)
+		}
+	}
+	switch {
+	case isContainer(old) || isContainer(new):
+		return some(new), subtree{}, some(old)
+	case !configEqual(old, new):
+		return subtree{}, some(new), subtree{}
+	}
+	return subtree{}, subtree{}, subtree{}
+}
+
+func diffObjects(old, new map[string]interface{}) (added, changed, removed subtree) {
+	var add, chg, rem map[string]interface{}
+	set := func(m *map[string]interface{}, k string, t subtree) {
+		if !t.present {
+			return
+		}
+		if *m == nil {
+			*m = make(map[string]interface{})
+		}
+		(*m)[k] = t.value
+	}
+	for k, nv := range new {
+		ov, ok := old[k]
+		if !ok {
+			set(&add, k, some(nv))
+			continue
+		}
+		a, c, r := diffConfig(ov, nv)
+		set(&add, k, a)
+		set(&chg, k, c)
+		set(&rem, k, r)
+	}
+	for k, ov := range old {
+		if _, ok := new[k]; !ok {
+			set(&rem, k, some(ov))
+		}
+	}
+	return nonEmpty(add), nonEmpty(chg), nonEmpty(rem)
+}
+
+// diffLists matches elements by value, in order, so that unchanged
+// elements are left out wherever they moved to.
+func diffLists(old, new []interface{}) (added, changed, removed subtree) {
+	unmatched := make(map[string][]int, len(old))
+	for i, v := range old {
+		key := configKey(v)
+		unmatched[key] = append(unmatched[key], i)
+	}
+	matched := make([]bool, len(old))
+	var add, rem []interface{}
+	for _, v := range new {
+		key := configKey(v)
+		if idx := unmatched[key]; len(idx) > 0 {
+			matched[idx[0]] = true
+			unmatched[key] = idx[1:]
+			continue
+		}
+		add = append(add, v)
+	}
+	for i, v := range old {
+		if !matched[i] {
+			rem = append(rem, v)
+		}
+	}
+	if len(add) > 0 {
+		added = some(add)
+	}
+	if len(rem) > 0 {
+		removed = some(rem)
+	}
+	return added, subtree{}, removed
+}
+
+// configKey is a canonical encoding of v; objects are encoded with
+// their members sorted.
+func configKey(v interface{}) string {
+	b, _ := json.Marshal(v)
+	return string(b)
+}
+
+func configEqual(a, b interface{}) bool {
+	switch a.(type) {
+	case json.Number, string, bool, nil:
+		return a == b
+	}
+	return configKey(a) == configKey(b)
+}
+
+func nonEmpty(m map[string]interface{}) subtree {
+	if len(m) == 0 {
+		return subtree{}
+	}
+	return some(m)
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+import (
+	"encoding/json"
+	"reflect"
+	"testing"
+)
+
+func TestComputeConfigDelta(t *testing.T) {
+	cases := []struct {
+		name, old, new, delta string
+	}{
+		{"unchanged", `{"a":1,"b":{"c":[1,2]}}`, `{"a":1,"b":{"c":[1,2]}}`,
+			`{"added":{},"changed":{},"removed":{}}`},
+		{"from nothing", ``, `{"a":1}`,
+			`{"added":{"a":1},"changed":{},"removed":{}}`},
+		{"leaf changed", `{"a":1,"b":"x"}`, `{"a":2,"b":"x"}`,
+			`{"added":{},"changed":{"a":2},"removed":{}}`},
+		{"member added and removed", `{"a":1}`, `{"b":true}`,
+			`{"added":{"b":true},"changed":{},"removed":{"a":1}}`},
+		{"nested", `{"a":{"b":1,"c":2}}`, `{"a":{"b":1,"c":3,"d":4}}`,
+			`{"added":{"a":{"d":4}},"changed":{"a":{"c":3}},"removed":{}}`},
+		{"leaf changed to null", `{"a":1}`, `{"a":null}`,
+			`{"added":{},"changed":{"a":null},"removed":{}}`},
+		{"leaf changed from null", `{"a":null}`, `{"a":1}`,
+			`{"added":{},"changed":{"a":1},"removed":{}}`},
+		{"null added", `{}`, `{"a":null}`,
+			`{"added":{"a":null},"changed":{},"removed":{}}`},
+		{"null removed", `{"a":null}`, `{}`,
+			`{"added":{},"changed":{},"removed":{"a":null}}`},
+		{"object replaced by leaf", `{"a":{"b":1}}`, `{"a":2}`,
+			`{"added":{"a":2},"changed":{},"removed":{"a":{"b":1}}}`},
+		{"leaf replaced by object", `{"a":2}`, `{"a":{"b":1}}`,
+			`{"added":{"a":{"b":1}},"changed":{},"removed":{"a":2}}`},
+		{"object replaced by list", `{"a":{"b":1}}`, `{"a":[1]}`,
+			`{"added":{"a":[1]},"changed":{},"removed":{"a":{"b":1}}}`},
+		{"list entries", `{"l":[{"n":"x","v":1},{"n":"y"}]}`,
+			`{"l":[{"n":"y"},{"n":"x","v":2},{"n":"z"}]}`,
+			`{"added":{"l":[{"n":"x","v":2},{"n":"z"}]},"changed":{},` +
+				`"removed":{"l":[{"n":"x","v":1}]}}`},
+		{"list with null", `{"l":[1]}`, `{"l":[1,null]}`,
+			`{"added":{"l":[null]},"changed":{},"removed":{}}`},
+	}
+	for _, c := range cases {
+		old, err := decodeConfig(encodedString(c.old))
+		if err != nil {
+			t.Fatalf("%s: %s", c.name, err)
+		}
+		new, err := decodeConfig(encodedString(c.new))
+		if err != nil {
+			t.Fatalf("%s: %s", c.name, err)
+		}
+		delta, err := computeConfigDelta(old, new)
+		if err != nil {
+			t.Fatalf("%s: %s", c.name, err)
+		}
+		var got, want interface{}
+		json.Unmarshal(delta, &got)
+		json.Unmarshal([]byte(c.delta), &want)
+		if !reflect.DeepEqual(got, want) {
+			t.Errorf("%s: got %s, want %s", c.name, delta, c.delta)
+		}
+	}
+}
@@ -0,0 +1,267 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+/*
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+*/
+import "C"
+import (
+	"errors"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"time"
+)
+
+/*
+A subscription normally calls its subscriber from the goroutine draining
+its queue. Once an application asks for the subscription's fd the drain
+goroutine instead hands each notification to a dispatcher, and the
+application runs the subscriber on its own thread through
+vci_subscription_dispatch whenever the fd polls readable.
+
+Between the two sits a single producer, single consumer ring: the drain
+goroutine is the only producer, as a queue has one drainer at a time,
+and the application is required to dispatch from one thread at a time.
+Neither side takes a lock. The consumer is woken only when it has
+announced, by clearing signalled, that it may go to sleep, so a busy
+subscription costs an eventfd write per poll cycle rather than per
+notification. A subscription attached to an executor (executor.go) is
+consumed the same way by whichever of the executor's threads picks it up.
+
+A full ring holds the drain goroutine back, which leaves notifications in
+the subscription's queue where its drop, block or coalesce policy applies
+to them as usual.
+*/
+
+const defaultRingSize = 256
+
+type dispatcher struct {
+	// Written by the producer, read by the consumer.
+	tail uint64
+	_    [56]byte
+	// Written by the consumer, read by the producer.
+	head uint64
+	_    [56]byte
+
+	ring      []encodedString
+	mask      uint64
+	signalled uint32
+	deliver   func([]encodedString)
+	wake      func()
+	space     chan struct{}
+	closeOnce sync.Once
+	closed    chan struct{}
+	stopped   <-chan struct{} // the executor's, nil for an fd
+	fd        C.int
+}
+
+// newDispatcher makes a dispatcher whose ring holds size notifications,
+// rounded up to a power of two.
+func newDispatcher(size int, deliver func([]encodedString)) *dispatcher {
+	if size <= 0 {
+		size = defaultRingSize
+	}
+	n := 1
+	for n < size {
+		n <<= 1
+	}
+	return &dispatcher{
+		ring:    make([]encodedString, n),
+		mask:    uint64(n - 1),
+		deliver: deliver,
+		space:   make(chan struct{}, 1),
+		closed:  make(chan struct{}),
+		fd:      -1,
+	}
+}
+
+func newFdDispatcher(deliver func([]encodedString)) (*dispatcher, error) {
+	fd, err := C.eventfd(0, C.EFD_NONBLOCK|C.EFD_CLOEXEC)
+	if fd < 0 && err == nil {
+		err = syscall.EMFILE
+	}
+	if fd < 0 {
+		return nil, err
+	}
+	d := newDispatcher(defaultRingSize, deliver)
+	d.fd = fd
+	d.wake = func() { C.eventfd_write(fd, 1) }
+	return d, nil
+}
+
+// push hands a notification to the consumer, waiting for room if the
+// ring is full. Once the dispatcher is closed notifications are dropped.
+func (d *dispatcher) push(in encodedString) {
+	tail := atomic.LoadUint64(&d.tail)
+	for tail-atomic.LoadUint64(&d.head) == uint64(len(d.ring)) {
+		select {
+		case <-d.space:
+		case <-d.closed:
+			return
+		case <-d.stopped:
+			return
+		}
+	}
+	d.ring[tail&d.mask] = in
+	atomic.StoreUint64(&d.tail, tail+1)
+	d.signal()
+}
+
+// signal wakes the consumer unless it has yet to clear an earlier signal.
+func (d *dispatcher) signal() {
+	if atomic.CompareAndSwapUint32(&d.signalled, 0, 1) {
+		d.wake()
+	}
+}
+
+func (d *dispatcher) pending() uint64 {
+	return atomic.LoadUint64(&d.tail) - atomic.LoadUint64(&d.head)
+}
+
+// take passes up to max waiting notifications, all of them if max is 0,
+// to deliver and returns how many it passed.
+func (d *dispatcher) take(max int) int {
+	head := atomic.LoadUint64(&d.head)
+	n := int(atomic.LoadUint64(&d.tail) - head)
+	if max > 0 && n > max {
+		n = max
+	}
+	if n == 0 {
+		return 0
+	}
+	// Hand over the ring in place, in at most two runs when it wraps.
+	for done := 0; done < n; {
+		start := int((head + uint64(done)) & d.mask)
+		run := n - done
+		if start+run > len(d.ring) {
+			run = len(d.ring) - start
+		}
+		d.deliver(d.ring[start : start+run])
+		for i := start; i < start+run; i++ {
+			d.ring[i] = nil
+		}
+		done += run
+	}
+	atomic.StoreUint64(&d.head, head+uint64(n))
+	select {
+	case d.space <- struct{}{}:
+	default:
+	}
+	return n
+}
+
+// dispatchFd is the consumer for an fd. The application polls the fd on
+// one thread, so the signal is cleared before the ring is read: anything
+// pushed before the clear is taken here and anything pushed after it
+// makes the fd readable again.
+func (d *dispatcher) dispatchFd(max int) int {
+	var count C.eventfd_t
+	C.eventfd_read(d.fd, &count)
+	atomic.StoreUint32(&d.signalled, 0)
+	n := d.take(max)
+	if d.pending() > 0 {
+		d.signal()
+	}
+	return n
+}
+
+// runOnce is the consumer for an executor. Any thread of the pool may
+// pick the dispatcher up, so it stays signalled, and off every other
+// thread's run queue, until the ring has been read.
+func (d *dispatcher) runOnce(max int) {
+	d.take(max)
+	atomic.StoreUint32(&d.signalled, 0)
+	if d.pending() > 0 {
+		d.signal()
+	}
+}
+
+func (d *dispatcher) close() {
+	d.closeOnce.Do(func() {
+		close(d.closed)
+		if d.fd >= 0 {
+			C.close(d.fd)
+		}
+	})
+}
+
+var errDispatcherSet = errors.New(
+	"vci: subscription already dispatched through an fd or executor")
+
+// deliverAll runs the subscriber for notifications handed over by the
+// drain goroutine, batching them as a batch subscriber asked.
+func (q *subscriptionQueue) deliverAll(ins []encodedString) {
+	for len(ins) > 0 {
+		start := time.Now()
+		if q.deliverBatch == nil {
+			q.deliver(ins[0])
+			ins = ins[1:]
+		} else {
+			n := len(ins)
+			if n > q.batchMax {
+				n = q.batchMax
+			}
+			if lost := q.deliverBatch(ins[:n]); lost > 0 {
+				q.lose(lost)
+			}
+			ins = ins[n:]
+		}
+		q.callback.add(time.Since(start))
+	}
+}
+
+// dispatchFd switches q to dispatch through an fd, returning it.
+func (q *subscriptionQueue) dispatchFd() (C.int, error) {
+	q.mu.Lock()
+	defer q.mu.Unlock()
+	if q.dispatcher == nil {
+		d, err := newFdDispatcher(q.deliverAll)
+		if err != nil {
+			return -1, err
+		}
+		q.dispatcher = d
+	}
+	if q.dispatcher.fd < 0 {
+		return -1, errDispatcherSet
+	}
+	return q.dispatcher.fd, nil
+}
+
+// dispatch runs the subscriber for up to max notifications.
+func (q *subscriptionQueue) dispatch(max int) int {
+	q.mu.Lock()
+	d := q.dispatcher
+	q.mu.Unlock()
+	if d == nil || d.fd < 0 {
+		return 0
+	}
+	return d.dispatchFd(max)
+}
+
+// setExecutor switches q to deliver on e's threads through a ring of
+// ringSize notifications.
+func (q *subscriptionQueue) setExecutor(e *executor, ringSize int) error {
+	q.mu.Lock()
+	defer q.mu.Unlock()
+	if q.dispatcher != nil {
+		return errDispatcherSet
+	}
+	q.dispatcher = e.attach(ringSize, q.deliverAll)
+	return nil
+}
+
+func (q *subscriptionQueue) closeDispatch() {
+	q.mu.Lock()
+	d := q.dispatcher
+	q.mu.Unlock()
+	if d != nil {
+		d.close()
+	}
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+/*
+#include <stdint.h>
+#include "../vci.h"
+*/
+import "C"
+import (
+	"errors"
+	"unsafe"
+
+	"github.com/danos/mgmterror"
+	"github.com/danos/vci"
+)
+
+/*
+The bus always carries JSON. A payloadEncoding is what a C caller or
+handler chose to see instead, and payloads are transcoded on their way
+across the C boundary; see cbor.go.
+*/
+
+type payloadEncoding uint32
+
+var errUnknownEncoding = errors.New("vci: unknown payload encoding")
+
+const (
+	encodingJSON payloadEncoding = C.VCI_ENCODING_JSON
+	encodingCBOR payloadEncoding = C.VCI_ENCODING_CBOR
+)
+
+func goEncoding(enc C.vci_encoding) (payloadEncoding, bool) {
+	switch payloadEncoding(enc) {
+	case encodingJSON, encodingCBOR:
+		return payloadEncoding(enc), true
+	}
+	return encodingJSON, false
+}
+
+// toC converts a JSON payload into enc.
+func (enc payloadEncoding) toC(in encodedString) (encodedString, error) {
+	if enc == encodingJSON {
+		return in, nil
+	}
+	out, err := jsonToCBOR(make([]byte, 0, len(in)), in)
+	return encodedString(out), err
+}
+
+// fromC converts a payload in enc into JSON, which may share in's memory.
+func (enc payloadEncoding) fromC(in []byte) (encodedString, error) {
+	if enc == encodingJSON {
+		return encodedString(in), nil
+	}
+	out, err := cborToJSON(make([]byte, 0, 2*len(in)), in)
+	return encodedString(out), err
+}
+
+// fromCPayload converts a (pointer, length) pair produced by C, reading
+// it in place where it is transcoded anyway.
+func (enc payloadEncoding) fromCPayload(data unsafe.Pointer, n C.size_t) (encodedString, error) {
+	if enc == encodingJSON || n > maxCWriteChunk {
+		return enc.fromC(goPayload(data, n))
+	}
+	return enc.fromC(cBytes(data, n))
+}
+
+// fromCBuf converts the output a handler wrote into b.
+func (enc payloadEncoding) fromCBuf(b *cBuf) (encodedString, error) {
+	return enc.fromCPayload(unsafe.Pointer(b.buf.data), b.buf.len)
+}
+
+// cBytes views n bytes of C memory, n being at most maxCWriteChunk.
+func cBytes(data unsafe.Pointer, n C.size_t) []byte {
+	if n == 0 {
+		return nil
+	}
+	return (*[maxCWriteChunk]byte)(data)[:n:n]
+}
+
+func encodingError(err error) error {
+	merr := mgmterror.NewOperationFailedApplicationError()
+	merr.AppTag = "vci-encoding"
+	merr.Message = err.Error()
+	return merr
+}
+
+// newEncodedClientCall issues a call whose input, and output, are in enc.
+func newEncodedClientCall(
+	client *vci.Client,
+	module, name string,
+	enc C.vci_encoding,
+	input unsafe.Pointer, inputLen C.size_t,
+) *clientCall {
+	encoding, ok := goEncoding(enc)
+	if !ok {
+		return &clientCall{err: errUnknownEncoding}
+	}
+	doc, err := encoding.fromCPayload(input, inputLen)
+	if err != nil {
+		return &clientCall{err: encodingError(err)}
+	}
+	call := newClientCall(client, module, name, string(doc))
+	call.enc = encoding
+	return call
+}
@@ -0,0 +1,149 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+/*
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+
+static void
+_vci_set_thread_name(const char *name)
+{
+	pthread_setname_np(pthread_self(), name);
+}
+*/
+import "C"
+import (
+	"fmt"
+	"runtime"
+	"sync"
+	"unsafe"
+)
+
+/*
+An executor runs subscribers on a pool of threads instead of the
+goroutines that drain subscription queues. Each subscription attached to
+it has its own dispatcher (dispatch.go) and is put on the run queue when
+its ring goes from empty to non-empty. A subscription is on the run
+queue, or being run, at most once, so its notifications are delivered in
+order by one thread at a time while different subscriptions run in
+parallel.
+
+The threads are either started by the library, each locked to its
+goroutine and named after the executor, or are the application's own
+threads calling vci_executor_run.
+*/
+
+// executorBatch bounds how many notifications a thread delivers for one
+// subscription before moving on to the next, so a busy subscription
+// cannot starve the others.
+const executorBatch = 64
+
+type executor struct {
+	name string
+
+	mu      sync.Mutex
+	ready   sync.Cond
+	runq    []*dispatcher
+	stopped chan struct{}
+	stop    sync.Once
+}
+
+func newExecutor(name string, threads int) *executor {
+	e := &executor{
+		name:    name,
+		stopped: make(chan struct{}),
+	}
+	e.ready.L = &e.mu
+	for i := 0; i < threads; i++ {
+		go e.thread(i)
+	}
+	return e
+}
+
+// threadName fits the executor's name and the thread's index within the
+// 15 bytes the kernel keeps.
+func (e *executor) threadName(i int) string {
+	suffix := fmt.Sprintf("-%d", i)
+	name := e.name
+	if max := 15 - len(suffix); len(name) > max {
+		name = name[:max]
+	}
+	return name + suffix
+}
+
+func (e *executor) thread(i int) {
+	// The thread is never unlocked, so it exits with the goroutine
+	// rather than being handed back to the runtime under our name.
+	runtime.LockOSThread()
+	name := C.CString(e.threadName(i))
+	C._vci_set_thread_name(name)
+	C.free(unsafe.Pointer(name))
+	e.run()
+}
+
+// run delivers notifications on the calling thread until the executor
+// is stopped.
+func (e *executor) run() {
+	for {
+		e.mu.Lock()
+		for len(e.runq) == 0 && !e.isStopped() {
+			e.ready.Wait()
+		}
+		if e.isStopped() {
+			e.mu.Unlock()
+			return
+		}
+		d := e.runq[0]
+		e.runq[0] = nil
+		e.runq = e.runq[1:]
+		e.mu.Unlock()
+		d.runOnce(executorBatch)
+	}
+}
+
+func (e *executor) isStopped() bool {
+	select {
+	case <-e.stopped:
+		return true
+	default:
+		return false
+	}
+}
+
+// schedule puts d on the run queue. Once the executor is stopped nothing
+// drains the queue, so d is left off it.
+func (e *executor) schedule(d *dispatcher) {
+	e.mu.Lock()
+	if e.isStopped() {
+		e.mu.Unlock()
+		return
+	}
+	e.runq = append(e.runq, d)
+	e.ready.Signal()
+	e.mu.Unlock()
+}
+
+// attach makes a dispatcher that delivers on the executor's threads.
+func (e *executor) attach(ringSize int, deliver func([]encodedString)) *dispatcher {
+	d := newDispatcher(ringSize, deliver)
+	d.stopped = e.stopped
+	d.wake = func() { e.schedule(d) }
+	return d
+}
+
+// shutdown stops the threads once they finish what they are delivering.
+// Notifications still waiting are dropped.
+func (e *executor) shutdown() {
+	e.stop.Do(func() {
+		e.mu.Lock()
+		close(e.stopped)
+		e.runq = nil
+		e.ready.Broadcast()
+		e.mu.Unlock()
+	})
+}
@@ -0,0 +1,22 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+import "testing"
+
+// TestExecutorStoppedSchedule checks that a subscription woken after its
+// executor stopped is not left on a run queue nothing drains.
+func TestExecutorStoppedSchedule(t *testing.T) {
+	e := newExecutor("test", 0)
+	d := e.attach(4, func([]encodedString) {})
+	e.shutdown()
+	d.push(encodedString("{}"))
+	e.mu.Lock()
+	defer e.mu.Unlock()
+	if len(e.runq) != 0 {
+		t.Errorf("%d subscriptions queued on a stopped executor", len(e.runq))
+	}
+}
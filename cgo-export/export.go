@@ -13,6 +13,8 @@ package main
 */
 import "C"
 import (
+	"syscall"
+	"time"
 	"unsafe"
 
 	"github.com/danos/vci"
@@ -20,17 +22,19 @@ import (
 
 //export _vci_component_new
 func _vci_component_new(name *C.char) C.uint64_t {
-	return C.uint64_t(objects.Register(vci.NewComponent(C.GoString(name))))
+	goName := C.GoString(name)
+	return C.uint64_t(components.Register(
+		&component{Component: vci.NewComponent(goName), name: goName}))
 }
 
 //export _vci_component_free
 func _vci_component_free(cd C.uint64_t) {
-	objects.Unregister(OD(cd))
+	components.Unregister(OD(cd))
 }
 
 //export _vci_component_run
 func _vci_component_run(cd C.uint64_t, cerr *C.vci_error) C.int {
-	err := objects.Get(OD(cd)).(vci.Component).Run()
+	err := components.Get(OD(cd)).(vci.Component).Run()
 	if err != nil {
 		error_to_vci_error(err, cerr)
 		return -1
@@ -40,7 +44,7 @@ func _vci_component_run(cd C.uint64_t, cerr *C.vci_error) C.int {
 
 //export _vci_component_wait
 func _vci_component_wait(cd C.uint64_t, cerr *C.vci_error) C.int {
-	err := objects.Get(OD(cd)).(vci.Component).Wait()
+	err := components.Get(OD(cd)).(vci.Component).Wait()
 	if err != nil {
 		error_to_vci_error(err, cerr)
 		return -1
@@ -50,7 +54,7 @@ func _vci_component_wait(cd C.uint64_t, cerr *C.vci_error) C.int {
 
 //export _vci_component_stop
 func _vci_component_stop(cd C.uint64_t, cerr *C.vci_error) C.int {
-	err := objects.Get(OD(cd)).(vci.Component).Stop()
+	err := components.Get(OD(cd)).(vci.Component).Stop()
 	if err != nil {
 		error_to_vci_error(err, cerr)
 		return -1
@@ -65,9 +69,9 @@ func _vci_component_subscribe(
 	sub *C.vci_subscriber_object,
 	cerr *C.vci_error,
 ) C.int {
-	err := objects.Get(OD(cd)).(vci.Component).
-		Subscribe(C.GoString(module), C.GoString(name),
-			cSubscriber(sub))
+	comp := components.Get(OD(cd)).(*component)
+	err := comp.Subscribe(C.GoString(module), C.GoString(name),
+		comp.subscriber(cSubscriber(sub)))
 	if err != nil {
 		error_to_vci_error(err, cerr)
 		return -1
@@ -75,13 +79,39 @@ func _vci_component_subscribe(
 	return 0
 }
 
+//export _vci_component_subscribe_v2
+func _vci_component_subscribe_v2(
+	cd C.uint64_t,
+	module, name *C.char,
+	sub *C.vci_subscriber_object_v2,
+	cerr *C.vci_error,
+) C.int {
+	comp := components.Get(OD(cd)).(*component)
+	err := comp.Subscribe(C.GoString(module), C.GoString(name),
+		comp.subscriber(cSubscriberV2(sub)))
+	if err != nil {
+		error_to_vci_error(err, cerr)
+		return -1
+	}
+	return 0
+}
+
+//export _vci_component_set_executor
+func _vci_component_set_executor(cd, ed C.uint64_t, ringSize C.size_t) {
+	var e *executor
+	if ed != 0 {
+		e = executors.Get(OD(ed)).(*executor)
+	}
+	components.Get(OD(cd)).(*component).setExecutor(e, int(ringSize))
+}
+
 //export _vci_component_unsubscribe
 func _vci_component_unsubscribe(
 	cd C.uint64_t,
 	module, name *C.char,
 	cerr *C.vci_error,
 ) C.int {
-	err := objects.Get(OD(cd)).(vci.Component).
+	err := components.Get(OD(cd)).(vci.Component).
 		Unsubscribe(C.GoString(module), C.GoString(name))
 	if err != nil {
 		error_to_vci_error(err, cerr)
@@ -92,24 +122,28 @@ func _vci_component_unsubscribe(
 
 //export _vci_component_model
 func _vci_component_model(cd C.uint64_t, name *C.char) C.uint64_t {
-	mod := objects.Get(OD(cd)).(vci.Component).Model(C.GoString(name))
-	return C.uint64_t(objects.Register(newModel(mod)))
+	comp := components.Get(OD(cd)).(*component)
+	modelName := C.GoString(name)
+	mod := comp.Model(modelName)
+	return C.uint64_t(models.Register(newModel(comp.name, modelName, mod)))
 }
 
 //export _vci_component_client
 func _vci_component_client(cd C.uint64_t) C.uint64_t {
-	client := objects.Get(OD(cd)).(vci.Component).Client()
-	return C.uint64_t(objects.Register(client))
+	client := components.Get(OD(cd)).(vci.Component).Client()
+	return C.uint64_t(clients.Register(client))
 }
 
 //export _vci_model_config
 func _vci_model_config(md C.uint64_t, cobj *C.vci_config_object) {
-	objects.Get(OD(md)).(vci.Model).Config(cConfig(cobj))
+	m := models.Get(OD(md)).(*model)
+	m.Config(cConfig(cobj, m.gate))
 }
 
 //export _vci_model_state
 func _vci_model_state(md C.uint64_t, cobj *C.vci_state_object) {
-	objects.Get(OD(md)).(vci.Model).State(cState(cobj))
+	m := models.Get(OD(md)).(*model)
+	m.State(cState(cobj, m.gate))
 }
 
 //export _vci_model_rpc
@@ -119,7 +153,7 @@ func _vci_model_rpc(
 	cobj *C.vci_rpc_object,
 ) {
 	name := C.GoString(modName)
-	vciModel := objects.Get(OD(md)).(vci.Model)
+	vciModel := models.Get(OD(md)).(vci.Model)
 	libvciModel := vciModel.(*model)
 	libvciModel.addRPC(name, C.GoString(rpcName), cobj)
 	vciModel.RPC(name, libvciModel.getModuleRPCs(name).RPCs())
@@ -132,15 +166,104 @@ func _vci_model_rpc_meta(
 	cobj *C.vci_rpc_meta_object,
 ) {
 	name := C.GoString(modName)
-	vciModel := objects.Get(OD(md)).(vci.Model)
+	vciModel := models.Get(OD(md)).(vci.Model)
 	libvciModel := vciModel.(*model)
 	libvciModel.addMetaRPC(name, C.GoString(rpcName), cobj)
 	vciModel.RPC(name, libvciModel.getModuleRPCs(name).RPCs())
 }
 
+//export _vci_model_config_v2
+func _vci_model_config_v2(md C.uint64_t, cobj *C.vci_config_object_v2) {
+	m := models.Get(OD(md)).(*model)
+	m.Config(cConfigV2(cobj, m.encoding, m.gate))
+}
+
+//export _vci_model_state_v2
+func _vci_model_state_v2(md C.uint64_t, cobj *C.vci_state_object_v2) {
+	m := models.Get(OD(md)).(*model)
+	m.State(cStateV2(cobj, m.encoding, m.gate))
+}
+
+//export _vci_model_rpc_v2
+func _vci_model_rpc_v2(
+	md C.uint64_t,
+	modName, rpcName *C.char,
+	cobj *C.vci_rpc_object_v2,
+) {
+	name := C.GoString(modName)
+	vciModel := models.Get(OD(md)).(vci.Model)
+	libvciModel := vciModel.(*model)
+	libvciModel.addRPCV2(name, C.GoString(rpcName), cobj)
+	vciModel.RPC(name, libvciModel.getModuleRPCs(name).RPCs())
+}
+
+//export _vci_model_rpc_meta_v2
+func _vci_model_rpc_meta_v2(
+	md C.uint64_t,
+	modName, rpcName *C.char,
+	cobj *C.vci_rpc_meta_object_v2,
+) {
+	name := C.GoString(modName)
+	vciModel := models.Get(OD(md)).(vci.Model)
+	libvciModel := vciModel.(*model)
+	libvciModel.addMetaRPCV2(name, C.GoString(rpcName), cobj)
+	vciModel.RPC(name, libvciModel.getModuleRPCs(name).RPCs())
+}
+
+//export _vci_model_set_encoding
+func _vci_model_set_encoding(md C.uint64_t, enc C.vci_encoding) C.int {
+	encoding, ok := goEncoding(enc)
+	if !ok {
+		return -1
+	}
+	models.Get(OD(md)).(*model).encoding = encoding
+	return 0
+}
+
+//export _vci_model_set_admission
+func _vci_model_set_admission(md C.uint64_t, maxInFlight, maxQueued C.uint32_t) {
+	m := models.Get(OD(md)).(*model)
+	m.gate.setLimits(int(maxInFlight), int(maxQueued))
+}
+
+//export _vci_model_set_rpc_admission
+func _vci_model_set_rpc_admission(
+	md C.uint64_t,
+	module, name *C.char,
+	maxInFlight, maxQueued C.uint32_t,
+) {
+	m := models.Get(OD(md)).(*model)
+	rpcGate(m, C.GoString(module), C.GoString(name)).
+		setLimits(int(maxInFlight), int(maxQueued))
+}
+
+//export _vci_model_admission_stats
+func _vci_model_admission_stats(
+	md C.uint64_t,
+	stats *C.vci_admission_statistics,
+) {
+	models.Get(OD(md)).(*model).gate.stats(stats)
+}
+
+//export _vci_model_rpc_admission_stats
+func _vci_model_rpc_admission_stats(
+	md C.uint64_t,
+	module, name *C.char,
+	stats *C.vci_admission_statistics,
+) {
+	m := models.Get(OD(md)).(*model)
+	rpcGate(m, C.GoString(module), C.GoString(name)).stats(stats)
+}
+
+//export _vci_model_stats
+func _vci_model_stats(md C.uint64_t) {
+	m := models.Get(OD(md)).(*model)
+	m.State(&statsState{component: m.component})
+}
+
 //export _vci_model_free
 func _vci_model_free(md C.uint64_t) {
-	objects.Unregister(OD(md))
+	models.Unregister(OD(md))
 }
 
 //export _vci_error_string
@@ -173,14 +296,14 @@ func _vci_client_dial(client *C.uint64_t, cerr *C.vci_error) C.int {
 		error_to_vci_error(err, cerr)
 		return -1
 	}
-	*client = C.uint64_t(objects.Register(cl))
+	*client = C.uint64_t(clients.Register(cl))
 	return 0
 }
 
 //export _vci_client_free
 func _vci_client_free(cd C.uint64_t, closeOnFree C.bool) {
-	client := objects.Get(OD(cd)).(*vci.Client)
-	objects.Unregister(OD(cd))
+	client := clients.Get(OD(cd)).(*vci.Client)
+	clients.Unregister(OD(cd))
 	if bool(closeOnFree) {
 		client.Close()
 	}
@@ -192,7 +315,7 @@ func _vci_client_emit(
 	module, name, data *C.char,
 	cerr *C.vci_error,
 ) C.int {
-	client := objects.Get(OD(cd)).(*vci.Client)
+	client := clients.Get(OD(cd)).(*vci.Client)
 	err := client.Emit(
 		C.GoString(module), C.GoString(name), C.GoString(data))
 	if err != nil {
@@ -202,6 +325,51 @@ func _vci_client_emit(
 	return 0
 }
 
+//export _vci_client_emit_v2
+func _vci_client_emit_v2(
+	cd C.uint64_t,
+	module, name *C.char,
+	data unsafe.Pointer, dataLen C.size_t,
+	cerr *C.vci_error,
+) C.int {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	err := client.Emit(
+		C.GoString(module), C.GoString(name),
+		goStringN(data, dataLen))
+	if err != nil {
+		error_to_vci_error(err, cerr)
+		return -1
+	}
+	return 0
+}
+
+//export _vci_client_emit_encoded
+func _vci_client_emit_encoded(
+	cd C.uint64_t,
+	module, name *C.char,
+	enc C.vci_encoding,
+	data unsafe.Pointer, dataLen C.size_t,
+	cerr *C.vci_error,
+) C.int {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	encoding, ok := goEncoding(enc)
+	if !ok {
+		error_to_vci_error(errUnknownEncoding, cerr)
+		return -1
+	}
+	doc, err := encoding.fromCPayload(data, dataLen)
+	if err != nil {
+		error_to_vci_error(err, cerr)
+		return -1
+	}
+	err = client.Emit(C.GoString(module), C.GoString(name), string(doc))
+	if err != nil {
+		error_to_vci_error(err, cerr)
+		return -1
+	}
+	return 0
+}
+
 //export _vci_client_store_config_by_model_into
 func _vci_client_store_config_by_model_into(
 	cd C.uint64_t,
@@ -209,7 +377,7 @@ func _vci_client_store_config_by_model_into(
 	output **C.char,
 	cerr *C.vci_error,
 ) C.int {
-	client := objects.Get(OD(cd)).(*vci.Client)
+	client := clients.Get(OD(cd)).(*vci.Client)
 	var out string
 	err := client.StoreConfigByModelInto(C.GoString(model), &out)
 	if err != nil {
@@ -220,6 +388,24 @@ func _vci_client_store_config_by_model_into(
 	return 0
 }
 
+//export _vci_client_store_config_by_model_into_v2
+func _vci_client_store_config_by_model_into_v2(
+	cd C.uint64_t,
+	model *C.char,
+	output *unsafe.Pointer, outputLen *C.size_t,
+	cerr *C.vci_error,
+) C.int {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	var out string
+	err := client.StoreConfigByModelInto(C.GoString(model), &out)
+	if err != nil {
+		error_to_vci_error(err, cerr)
+		return -1
+	}
+	*output, *outputLen = cOutput(out)
+	return 0
+}
+
 //export _vci_client_store_state_by_model_into
 func _vci_client_store_state_by_model_into(
 	cd C.uint64_t,
@@ -227,7 +413,7 @@ func _vci_client_store_state_by_model_into(
 	output **C.char,
 	cerr *C.vci_error,
 ) C.int {
-	client := objects.Get(OD(cd)).(*vci.Client)
+	client := clients.Get(OD(cd)).(*vci.Client)
 	var out string
 	err := client.StoreStateByModelInto(C.GoString(model), &out)
 	if err != nil {
@@ -238,17 +424,148 @@ func _vci_client_store_state_by_model_into(
 	return 0
 }
 
+//export _vci_client_store_state_by_model_into_v2
+func _vci_client_store_state_by_model_into_v2(
+	cd C.uint64_t,
+	model *C.char,
+	output *unsafe.Pointer, outputLen *C.size_t,
+	cerr *C.vci_error,
+) C.int {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	var out string
+	err := client.StoreStateByModelInto(C.GoString(model), &out)
+	if err != nil {
+		error_to_vci_error(err, cerr)
+		return -1
+	}
+	*output, *outputLen = cOutput(out)
+	return 0
+}
+
+//export _vci_client_read_config_by_model
+func _vci_client_read_config_by_model(
+	cd C.uint64_t,
+	model *C.char,
+	chunkSize C.size_t,
+	reader C.vci_chunk_reader, ctx unsafe.Pointer,
+	cerr *C.vci_error,
+) C.int {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	var out string
+	err := client.StoreConfigByModelInto(C.GoString(model), &out)
+	if err != nil {
+		error_to_vci_error(err, cerr)
+		return -1
+	}
+	return readChunks(out, chunkSize, reader, ctx)
+}
+
+//export _vci_client_read_state_by_model
+func _vci_client_read_state_by_model(
+	cd C.uint64_t,
+	model *C.char,
+	chunkSize C.size_t,
+	reader C.vci_chunk_reader, ctx unsafe.Pointer,
+	cerr *C.vci_error,
+) C.int {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	var out string
+	err := client.StoreStateByModelInto(C.GoString(model), &out)
+	if err != nil {
+		error_to_vci_error(err, cerr)
+		return -1
+	}
+	return readChunks(out, chunkSize, reader, ctx)
+}
+
 //export _vci_client_call
 func _vci_client_call(cd C.uint64_t, module, name, input *C.char) C.uint64_t {
-	client := objects.Get(OD(cd)).(*vci.Client)
-	rpccall := client.Call(C.GoString(module),
+	client := clients.Get(OD(cd)).(*vci.Client)
+	rpccall := newClientCall(client, C.GoString(module),
 		C.GoString(name), C.GoString(input))
-	return C.uint64_t(objects.Register(rpccall))
+	return C.uint64_t(rpccalls.Register(rpccall))
+}
+
+//export _vci_client_call_v2
+func _vci_client_call_v2(
+	cd C.uint64_t,
+	module, name *C.char,
+	input unsafe.Pointer, inputLen C.size_t,
+) C.uint64_t {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	rpccall := newClientCall(client, C.GoString(module),
+		C.GoString(name), goStringN(input, inputLen))
+	return C.uint64_t(rpccalls.Register(rpccall))
+}
+
+//export _vci_client_call_encoded
+func _vci_client_call_encoded(
+	cd C.uint64_t,
+	module, name *C.char,
+	enc C.vci_encoding,
+	input unsafe.Pointer, inputLen C.size_t,
+) C.uint64_t {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	rpccall := newEncodedClientCall(client, C.GoString(module),
+		C.GoString(name), enc, input, inputLen)
+	return C.uint64_t(rpccalls.Register(rpccall))
+}
+
+//export _vci_client_call_async
+func _vci_client_call_async(
+	cd C.uint64_t,
+	module, name *C.char,
+	input unsafe.Pointer, inputLen C.size_t,
+	cb C.vci_rpccall_callback, ctx unsafe.Pointer,
+) {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	rpccall := newClientCall(client, C.GoString(module),
+		C.GoString(name), goStringN(input, inputLen))
+	go completeRPCCall(rpccall, cb, ctx)
+}
+
+//export _vci_client_call_batch
+func _vci_client_call_batch(
+	cd C.uint64_t,
+	module, name *C.char,
+	inputs *C.vci_payload, count C.size_t,
+	results *C.vci_rpc_result,
+) C.int {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	moduleName, rpcName := C.GoString(module), C.GoString(name)
+	ins := cPayloads(inputs, count)
+	outs := cRPCResults(results, count)
+
+	// Issue every call before waiting on any reply so the whole batch
+	// is in flight on the bus at once.
+	calls := make([]*clientCall, len(ins))
+	for i := range ins {
+		calls[i] = newClientCall(client, moduleName, rpcName,
+			goStringN(ins[i].data, ins[i].len))
+	}
+
+	var rc C.int
+	for i, rpccall := range calls {
+		res := &outs[i]
+		_vci_error_init(&res.err)
+		res.output, res.output_len = nil, 0
+		var out string
+		err := rpccall.StoreOutputInto(&out)
+		if err != nil {
+			error_to_vci_error(err, &res.err)
+			res.rc = -1
+			rc = -1
+			continue
+		}
+		res.rc = 0
+		res.output, res.output_len = cOutput(out)
+	}
+	return rc
 }
 
 //export _vci_rpccall_free
 func _vci_rpccall_free(rd C.uint64_t) {
-	objects.Unregister(OD(rd))
+	rpccalls.Unregister(OD(rd))
 }
 
 //export _vci_rpccall_store_output_into
@@ -258,7 +575,7 @@ func _vci_rpccall_store_output_into(
 	cerr *C.vci_error,
 ) C.int {
 	var out string
-	rpccall := objects.Get(OD(rd)).(*vci.RPCCall)
+	rpccall := rpccalls.Get(OD(rd)).(*clientCall)
 	err := rpccall.StoreOutputInto(&out)
 	if err != nil {
 		error_to_vci_error(err, cerr)
@@ -268,27 +585,140 @@ func _vci_rpccall_store_output_into(
 	return 0
 }
 
+//export _vci_rpccall_store_output_into_v2
+func _vci_rpccall_store_output_into_v2(
+	rd C.uint64_t,
+	output *unsafe.Pointer, outputLen *C.size_t,
+	cerr *C.vci_error,
+) C.int {
+	var out string
+	rpccall := rpccalls.Get(OD(rd)).(*clientCall)
+	err := rpccall.StoreOutputInto(&out)
+	if err != nil {
+		error_to_vci_error(err, cerr)
+		return -1
+	}
+	*output, *outputLen = cOutput(out)
+	return 0
+}
+
 //export _vci_client_subscribe
 func _vci_client_subscribe(
 	cd C.uint64_t,
 	module, name *C.char,
 	sub *C.vci_subscriber_object,
 ) C.uint64_t {
-	client := objects.Get(OD(cd)).(*vci.Client)
-	subscription := client.Subscribe(
+	client := clients.Get(OD(cd)).(*vci.Client)
+	subscription := newSubscription(client,
 		C.GoString(module), C.GoString(name), cSubscriber(sub))
-	return C.uint64_t(objects.Register(subscription))
+	return C.uint64_t(subscriptions.Register(subscription))
+
+}
+
+//export _vci_client_subscribe_v2
+func _vci_client_subscribe_v2(
+	cd C.uint64_t,
+	module, name *C.char,
+	sub *C.vci_subscriber_object_v2,
+) C.uint64_t {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	subscription := newSubscription(client,
+		C.GoString(module), C.GoString(name), cSubscriberV2(sub))
+	return C.uint64_t(subscriptions.Register(subscription))
+}
+
+//export _vci_client_subscribe_batch
+func _vci_client_subscribe_batch(
+	cd C.uint64_t,
+	module, name *C.char,
+	sub *C.vci_batch_subscriber_object,
+) C.uint64_t {
+	client := clients.Get(OD(cd)).(*vci.Client)
+	subscription := newBatchSubscription(client,
+		C.GoString(module), C.GoString(name), cBatchSubscriber(sub),
+		int(sub.max_batch),
+		time.Duration(sub.max_delay_us)*time.Microsecond)
+	return C.uint64_t(subscriptions.Register(subscription))
+}
+
+//export _vci_subscription_set_encoding
+func _vci_subscription_set_encoding(sd C.uint64_t, enc C.vci_encoding) C.int {
+	encoding, ok := goEncoding(enc)
+	if !ok {
+		return -1
+	}
+	subscriptions.Get(OD(sd)).(*subscription).setEncoding(encoding)
+	return 0
+}
+
+//export _vci_subscription_fd
+func _vci_subscription_fd(sd C.uint64_t) C.int {
+	fd, err := subscriptions.Get(OD(sd)).(*subscription).queue.dispatchFd()
+	// errno does not survive the return to C, so pass it back.
+	switch err := err.(type) {
+	case nil:
+		return fd
+	case syscall.Errno:
+		return -C.int(err)
+	}
+	if err == errDispatcherSet {
+		return -C.int(syscall.EBUSY)
+	}
+	return -C.int(syscall.EIO)
+}
+
+//export _vci_subscription_dispatch
+func _vci_subscription_dispatch(sd C.uint64_t, max C.size_t) C.int {
+	return C.int(subscriptions.Get(OD(sd)).(*subscription).queue.
+		dispatch(int(max)))
+}
+
+//export _vci_subscription_set_executor
+func _vci_subscription_set_executor(sd, ed C.uint64_t, ringSize C.size_t) C.int {
+	e := executors.Get(OD(ed)).(*executor)
+	err := subscriptions.Get(OD(sd)).(*subscription).queue.
+		setExecutor(e, int(ringSize))
+	if err != nil {
+		return -1
+	}
+	return 0
+}
 
+//export _vci_executor_new
+func _vci_executor_new(name *C.char, threads C.size_t) C.uint64_t {
+	return C.uint64_t(executors.Register(
+		newExecutor(C.GoString(name), int(threads))))
+}
+
+//export _vci_executor_run
+func _vci_executor_run(ed C.uint64_t) {
+	executors.Get(OD(ed)).(*executor).run()
+}
+
+//export _vci_executor_stop
+func _vci_executor_stop(ed C.uint64_t) {
+	executors.Get(OD(ed)).(*executor).shutdown()
+}
+
+//export _vci_executor_free
+func _vci_executor_free(ed C.uint64_t) {
+	if e, ok := executors.Get(OD(ed)).(*executor); ok {
+		e.shutdown()
+	}
+	executors.Unregister(OD(ed))
 }
 
 //export _vci_subscription_free
 func _vci_subscription_free(sd C.uint64_t) {
-	objects.Unregister(OD(sd))
+	if s, ok := subscriptions.Get(OD(sd)).(*subscription); ok {
+		s.queue.closeDispatch()
+	}
+	subscriptions.Unregister(OD(sd))
 }
 
 //export _vci_subscription_run
 func _vci_subscription_run(sd C.uint64_t, cerr *C.vci_error) C.int {
-	err := objects.Get(OD(sd)).(*vci.Subscription).Run()
+	err := subscriptions.Get(OD(sd)).(*subscription).Run()
 	if err != nil {
 		error_to_vci_error(err, cerr)
 		return -1
@@ -298,7 +728,7 @@ func _vci_subscription_run(sd C.uint64_t, cerr *C.vci_error) C.int {
 
 //export _vci_subscription_cancel
 func _vci_subscription_cancel(sd C.uint64_t, cerr *C.vci_error) C.int {
-	err := objects.Get(OD(sd)).(*vci.Subscription).Cancel()
+	err := subscriptions.Get(OD(sd)).(*subscription).Cancel()
 	if err != nil {
 		error_to_vci_error(err, cerr)
 		return -1
@@ -308,22 +738,53 @@ func _vci_subscription_cancel(sd C.uint64_t, cerr *C.vci_error) C.int {
 
 //export _vci_subscription_coalesce
 func _vci_subscription_coalesce(sd C.uint64_t) {
-	objects.Get(OD(sd)).(*vci.Subscription).Coalesce()
+	subscriptions.Get(OD(sd)).(*subscription).queue.
+		setPolicy(queueCoalesce, 0)
+}
+
+//export _vci_subscription_coalesce_by_key
+func _vci_subscription_coalesce_by_key(sd C.uint64_t, path *C.char) C.int {
+	err := subscriptions.Get(OD(sd)).(*subscription).queue.
+		coalesceByKey(C.GoString(path))
+	if err != nil {
+		return -1
+	}
+	return 0
 }
 
 //export _vci_subscription_drop_after_limit
 func _vci_subscription_drop_after_limit(sd C.uint64_t, limit C.uint32_t) {
-	objects.Get(OD(sd)).(*vci.Subscription).DropAfterLimit(int(limit))
+	subscriptions.Get(OD(sd)).(*subscription).queue.
+		setPolicy(queueDrop, int(limit))
 }
 
 //export _vci_subscription_block_after_limit
 func _vci_subscription_block_after_limit(sd C.uint64_t, limit C.uint32_t) {
-	objects.Get(OD(sd)).(*vci.Subscription).BlockAfterLimit(int(limit))
+	subscriptions.Get(OD(sd)).(*subscription).queue.
+		setPolicy(queueBlock, int(limit))
+}
+
+//export _vci_subscription_block_with_watermarks
+func _vci_subscription_block_with_watermarks(
+	sd C.uint64_t,
+	high, low C.uint32_t,
+) {
+	subscriptions.Get(OD(sd)).(*subscription).queue.
+		setWatermarks(queueBlock, int(high), int(low))
 }
 
 //export _vci_subscription_remove_limit
 func _vci_subscription_remove_limit(sd C.uint64_t) {
-	objects.Get(OD(sd)).(*vci.Subscription).RemoveLimit()
+	subscriptions.Get(OD(sd)).(*subscription).queue.
+		setPolicy(queueUnlimited, 0)
+}
+
+//export _vci_subscription_stats
+func _vci_subscription_stats(
+	sd C.uint64_t,
+	stats *C.vci_subscription_statistics,
+) {
+	subscriptions.Get(OD(sd)).(*subscription).queue.stats(stats)
 }
 
 func main() {
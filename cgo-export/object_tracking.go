@@ -1,4 +1,4 @@
-// Copyright (c) 2018-2019, AT&T Intellectual Property.
+// Copyright (c) 2018-2021, AT&T Intellectual Property.
 // All rights reserved.
 //
 // SPDX-License-Identifier: LGPL-2.1-only
@@ -7,53 +7,186 @@ package main
 
 import (
 	"sync"
+	"sync/atomic"
+	"unsafe"
 )
 
 /*
 We need to track the objects we are handing to C to keep it alive
-in the go code. We use a monotonically increasing descriptor as a
-reference for a compnent and keep track of it in a map. This is also
-required for other types since go has a moving gc so pointers to an
-object may change under the covers
+in the go code. We hand out a descriptor as a reference for each object
+and keep track of it in a table. This is also required for other types
+since go has a moving gc so pointers to an object may change under the
+covers.
+
+Every C entry point looks its object up, so the read path takes no lock.
+A table is split into shards, each a slab of fixed size chunks whose
+directory is replaced copy-on-write when the shard grows, so a reader
+only ever needs atomic loads. Registration and removal serialise on the
+shard they touch. A descriptor carries the slot's generation, which is
+bumped whenever the slot is reused, so a stale descriptor finds nothing
+rather than somebody else's object.
+
+Descriptor layout: generation (32 bits) | shard (4 bits) | index (28 bits)
 */
 
 type OD uint64
 
+const (
+	odShardBits = 4
+	odShards    = 1 << odShardBits
+	odIndexBits = 28
+	odIndexMask = 1<<odIndexBits - 1
+	odChunkBits = 10
+	odChunkSize = 1 << odChunkBits
+	odChunkMask = odChunkSize - 1
+)
+
+func makeOD(gen uint32, shard, index uint32) OD {
+	return OD(gen)<<32 | OD(shard)<<odIndexBits | OD(index)
+}
+
+func (od OD) generation() uint32 {
+	return uint32(od >> 32)
+}
+
+func (od OD) shard() uint32 {
+	return uint32(od>>odIndexBits) & (odShards - 1)
+}
+
+func (od OD) index() uint32 {
+	return uint32(od) & odIndexMask
+}
+
+type odEntry struct {
+	gen    uint32
+	object interface{}
+}
+
+type odChunk [odChunkSize]unsafe.Pointer // *odEntry
+
+// The padding keeps the directory readers load off the cache line the
+// writers update and neighbouring shards apart.
+type odShard struct {
+	chunks unsafe.Pointer // *[]*odChunk
+	_      [56]byte
+
+	mu   sync.Mutex
+	gens []uint32
+	free []uint32
+	_    [8]byte
+}
+
+func (sh *odShard) chunkList() []*odChunk {
+	chunks := (*[]*odChunk)(atomic.LoadPointer(&sh.chunks))
+	if chunks == nil {
+		return nil
+	}
+	return *chunks
+}
+
+func (sh *odShard) slot(index uint32) *unsafe.Pointer {
+	chunks := sh.chunkList()
+	if int(index>>odChunkBits) >= len(chunks) {
+		return nil
+	}
+	return &chunks[index>>odChunkBits][index&odChunkMask]
+}
+
+// allocate returns a free slot index. Called with sh.mu held.
+func (sh *odShard) allocate() (uint32, bool) {
+	if n := len(sh.free); n > 0 {
+		index := sh.free[n-1]
+		sh.free = sh.free[:n-1]
+		return index, true
+	}
+	index := uint32(len(sh.gens))
+	if index > odIndexMask {
+		return 0, false
+	}
+	if index&odChunkMask == 0 {
+		old := sh.chunkList()
+		chunks := make([]*odChunk, len(old), len(old)+1)
+		copy(chunks, old)
+		chunks = append(chunks, new(odChunk))
+		atomic.StorePointer(&sh.chunks, unsafe.Pointer(&chunks))
+	}
+	sh.gens = append(sh.gens, 0)
+	return index, true
+}
+
 type objectTracker struct {
-	currentDescriptor OD
-	objects           map[OD]interface{}
-	mu                sync.RWMutex
+	shards    [odShards]odShard
+	nextShard uint32
 }
 
 func objectTrackerNew() *objectTracker {
-	return &objectTracker{
-		objects: make(map[OD]interface{}),
-	}
+	return &objectTracker{}
 }
 
 func (ot *objectTracker) Register(object interface{}) OD {
-	ot.mu.Lock()
-	defer ot.mu.Unlock()
-	od := ot.currentDescriptor
-	ot.objects[od] = object
-	ot.currentDescriptor++
-	return od
+	shard := atomic.AddUint32(&ot.nextShard, 1) % odShards
+	sh := &ot.shards[shard]
+	sh.mu.Lock()
+	defer sh.mu.Unlock()
+	index, ok := sh.allocate()
+	if !ok {
+		panic("vci: object descriptor table exhausted")
+	}
+	sh.gens[index]++
+	if sh.gens[index] == 0 {
+		sh.gens[index] = 1
+	}
+	gen := sh.gens[index]
+	atomic.StorePointer(sh.slot(index),
+		unsafe.Pointer(&odEntry{gen: gen, object: object}))
+	return makeOD(gen, shard, index)
 }
 
 func (ot *objectTracker) Unregister(od OD) {
-	ot.mu.Lock()
-	defer ot.mu.Unlock()
-	delete(ot.objects, od)
+	sh := &ot.shards[od.shard()]
+	sh.mu.Lock()
+	defer sh.mu.Unlock()
+	slot := sh.slot(od.index())
+	if slot == nil {
+		return
+	}
+	entry := (*odEntry)(atomic.LoadPointer(slot))
+	if entry == nil || entry.gen != od.generation() {
+		return
+	}
+	atomic.StorePointer(slot, nil)
+	sh.free = append(sh.free, od.index())
 }
 
 func (ot *objectTracker) Get(od OD) interface{} {
-	ot.mu.RLock()
-	defer ot.mu.RUnlock()
-	return ot.objects[od]
+	slot := ot.shards[od.shard()].slot(od.index())
+	if slot == nil {
+		return nil
+	}
+	entry := (*odEntry)(atomic.LoadPointer(slot))
+	if entry == nil || entry.gen != od.generation() {
+		return nil
+	}
+	return entry.object
 }
 
-var objects *objectTracker
+// One table per kind of object so unrelated objects do not share shards.
+var (
+	components    *objectTracker
+	models        *objectTracker
+	clients       *objectTracker
+	rpccalls      *objectTracker
+	subscriptions *objectTracker
+	stateWriters  *objectTracker
+	executors     *objectTracker
+)
 
 func init() {
-	objects = objectTrackerNew()
+	components = objectTrackerNew()
+	models = objectTrackerNew()
+	clients = objectTrackerNew()
+	rpccalls = objectTrackerNew()
+	subscriptions = objectTrackerNew()
+	stateWriters = objectTrackerNew()
+	executors = objectTrackerNew()
 }
@@ -0,0 +1,190 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+import (
+	"fmt"
+	"math"
+	"runtime"
+	"sync"
+	"testing"
+)
+
+// registerAt registers objects until one lands in the slot od named,
+// returning its descriptor.
+func registerAt(t *testing.T, ot *objectTracker, od OD, object interface{}) OD {
+	for i := 0; i < odShards; i++ {
+		next := ot.Register(object)
+		if next.shard() == od.shard() && next.index() == od.index() {
+			return next
+		}
+	}
+	t.Fatalf("slot %d/%d was not reused", od.shard(), od.index())
+	return 0
+}
+
+func TestObjectStaleDescriptor(t *testing.T) {
+	ot := objectTrackerNew()
+	a := ot.Register("a")
+	if got := ot.Get(a); got != "a" {
+		t.Fatalf("got %v, want a", got)
+	}
+	ot.Unregister(a)
+	if got := ot.Get(a); got != nil {
+		t.Errorf("unregistered descriptor found %v", got)
+	}
+
+	b := registerAt(t, ot, a, "b")
+	if b.generation() == a.generation() {
+		t.Fatalf("slot reused with the same generation %d", b.generation())
+	}
+	if got := ot.Get(a); got != nil {
+		t.Errorf("stale descriptor found %v", got)
+	}
+	// A stale descriptor must not free the slot from under its new owner.
+	ot.Unregister(a)
+	if got := ot.Get(b); got != "b" {
+		t.Errorf("got %v, want b", got)
+	}
+}
+
+func TestObjectWrongShard(t *testing.T) {
+	ot := objectTrackerNew()
+	a := ot.Register("a")
+	other := (a.shard() + 1) % odShards
+	wrong := makeOD(a.generation(), other, a.index())
+	if got := ot.Get(wrong); got != nil {
+		t.Errorf("wrong shard found %v", got)
+	}
+	ot.Unregister(wrong)
+	if got := ot.Get(a); got != "a" {
+		t.Errorf("got %v, want a", got)
+	}
+
+	// Once the other shard's slot has moved on a generation, a descriptor
+	// carrying a's generation misses there too.
+	b := registerAt(t, ot, wrong, "b")
+	ot.Unregister(b)
+	c := registerAt(t, ot, wrong, "c")
+	if c.generation() == a.generation() {
+		t.Fatalf("slot reused with the same generation %d", c.generation())
+	}
+	if got := ot.Get(wrong); got != nil {
+		t.Errorf("wrong shard found %v", got)
+	}
+	if got := ot.Get(c); got != "c" {
+		t.Errorf("got %v, want c", got)
+	}
+
+	beyond := makeOD(a.generation(), a.shard(), a.index()+odChunkSize)
+	if got := ot.Get(beyond); got != nil {
+		t.Errorf("index beyond the shard found %v", got)
+	}
+	ot.Unregister(beyond)
+}
+
+func TestObjectGenerationWrap(t *testing.T) {
+	ot := objectTrackerNew()
+	a := ot.Register("a")
+	ot.Unregister(a)
+	sh := &ot.shards[a.shard()]
+	sh.mu.Lock()
+	sh.gens[a.index()] = math.MaxUint32
+	sh.mu.Unlock()
+	b := registerAt(t, ot, a, "b")
+	if b.generation() == 0 {
+		t.Error("slot reused with generation 0")
+	}
+	if got := ot.Get(b); got != "b" {
+		t.Errorf("got %v, want b", got)
+	}
+}
+
+// mutexTracker is the single map behind a RWMutex the descriptor table
+// replaced, kept here as the baseline for the benchmarks.
+type mutexTracker struct {
+	current OD
+	objects map[OD]interface{}
+	mu      sync.RWMutex
+}
+
+func (mt *mutexTracker) Register(object interface{}) OD {
+	mt.mu.Lock()
+	defer mt.mu.Unlock()
+	od := mt.current
+	mt.objects[od] = object
+	mt.current++
+	return od
+}
+
+func (mt *mutexTracker) Unregister(od OD) {
+	mt.mu.Lock()
+	defer mt.mu.Unlock()
+	delete(mt.objects, od)
+}
+
+func (mt *mutexTracker) Get(od OD) interface{} {
+	mt.mu.RLock()
+	defer mt.mu.RUnlock()
+	return mt.objects[od]
+}
+
+type tracker interface {
+	Register(object interface{}) OD
+	Unregister(od OD)
+	Get(od OD) interface{}
+}
+
+var trackers = []struct {
+	name string
+	new  func() tracker
+}{
+	{"slab", func() tracker { return objectTrackerNew() }},
+	{"rwmutex", func() tracker {
+		return &mutexTracker{objects: make(map[OD]interface{})}
+	}},
+}
+
+func benchProcs(b *testing.B, fn func(b *testing.B, t tracker)) {
+	for _, tr := range trackers {
+		for _, procs := range []int{1, 2, 4, 8, 16} {
+			name := fmt.Sprintf("%s/procs=%d", tr.name, procs)
+			b.Run(name, func(b *testing.B) {
+				defer runtime.GOMAXPROCS(runtime.GOMAXPROCS(procs))
+				fn(b, tr.new())
+			})
+		}
+	}
+}
+
+func BenchmarkObjectGet(b *testing.B) {
+	benchProcs(b, func(b *testing.B, t tracker) {
+		ods := make([]OD, 1024)
+		for i := range ods {
+			ods[i] = t.Register(i)
+		}
+		b.ResetTimer()
+		b.RunParallel(func(pb *testing.PB) {
+			i := 0
+			for pb.Next() {
+				if t.Get(ods[i&1023]) == nil {
+					b.Fatal("lost object")
+				}
+				i++
+			}
+		})
+	})
+}
+
+func BenchmarkObjectRegister(b *testing.B) {
+	benchProcs(b, func(b *testing.B, t tracker) {
+		b.RunParallel(func(pb *testing.PB) {
+			for pb.Next() {
+				t.Unregister(t.Register(struct{}{}))
+			}
+		})
+	})
+}
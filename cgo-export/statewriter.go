@@ -0,0 +1,82 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+/*
+#include <stdint.h>
+#include <stddef.h>
+*/
+import "C"
+import (
+	"math"
+	"syscall"
+	"unsafe"
+)
+
+// Bounds the byte array view of a chunk, kept small enough for the array
+// type to be valid on 32 bit targets.
+const maxCWriteChunk = 1 << 30
+
+// maxStateReserve bounds the size a document may be reserved up to, so
+// that it fits an int on every target.
+const maxStateReserve = math.MaxInt32
+
+// stateWriter accumulates the chunks a streaming state object writes.
+type stateWriter struct {
+	doc    encodedString
+	failed bool
+}
+
+//export _vci_state_writer_reserve
+func _vci_state_writer_reserve(wd C.uint64_t, size C.size_t) C.int {
+	w, ok := stateWriters.Get(OD(wd)).(*stateWriter)
+	if !ok {
+		// errno does not survive the return to C, so pass it back.
+		return -C.int(syscall.EBADF)
+	}
+	if uint64(size) > uint64(maxStateReserve-len(w.doc)) {
+		return -C.int(syscall.EOVERFLOW)
+	}
+	if want := len(w.doc) + int(size); want > cap(w.doc) {
+		doc := make(encodedString, len(w.doc), want)
+		copy(doc, w.doc)
+		w.doc = doc
+	}
+	return 0
+}
+
+//export _vci_state_writer_write
+func _vci_state_writer_write(
+	wd C.uint64_t,
+	data unsafe.Pointer, size C.size_t,
+) C.int {
+	w, ok := stateWriters.Get(OD(wd)).(*stateWriter)
+	if !ok {
+		return -1
+	}
+	if w.failed {
+		return 0
+	}
+	for size > 0 {
+		n := size
+		if n > maxCWriteChunk {
+			n = maxCWriteChunk
+		}
+		w.doc = append(w.doc, (*[maxCWriteChunk]byte)(data)[:n:n]...)
+		data = unsafe.Pointer(uintptr(data) + uintptr(n))
+		size -= n
+	}
+	return 0
+}
+
+//export _vci_state_writer_fail
+func _vci_state_writer_fail(wd C.uint64_t) {
+	w, ok := stateWriters.Get(OD(wd)).(*stateWriter)
+	if !ok {
+		return
+	}
+	w.doc, w.failed = nil, true
+}
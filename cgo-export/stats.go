@@ -0,0 +1,374 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+/*
+#include <stdlib.h>
+#include <stdint.h>
+#include "../vci.h"
+*/
+import "C"
+import (
+	"encoding/json"
+	"math/bits"
+	"sort"
+	"strconv"
+	"sync"
+	"sync/atomic"
+	"time"
+	"unsafe"
+
+	"github.com/danos/vci"
+)
+
+/*
+Every RPC handled by a component, and every RPC made through a client, is
+counted. Handlers find their counters when they are registered so the
+call path only pays for two clock reads and a handful of atomic adds.
+Latencies go into a log-linear histogram: each power of two is split into
+histSub buckets, so a reported quantile is within 1/histSub of the true
+value.
+*/
+
+const (
+	histSubBits = 3
+	histSub     = 1 << histSubBits
+	histBuckets = (64 - histSubBits + 1) * histSub
+
+	// Bounds the C array view of a snapshot on 32 bit targets.
+	maxCRPCStats = 1 << 20
+)
+
+func histBucket(v uint64) int {
+	if v < histSub {
+		return int(v)
+	}
+	exp := uint(bits.Len64(v) - histSubBits)
+	return int(exp)*histSub + int((v>>(exp-1))&(histSub-1))
+}
+
+// histBucketMax is the largest value recorded in bucket b.
+func histBucketMax(b int) uint64 {
+	if b < histSub {
+		return uint64(b)
+	}
+	exp := uint(b / histSub)
+	sub := uint64(b % histSub)
+	return (histSub+sub+1)<<(exp-1) - 1
+}
+
+// histogram counts durations, it is updated and read atomically.
+type histogram [histBuckets]uint64
+
+func (h *histogram) add(d time.Duration) {
+	if d < 0 {
+		d = 0
+	}
+	atomic.AddUint64(&h[histBucket(uint64(d))], 1)
+}
+
+// quantiles returns the 50th, 99th and 99.9th percentiles.
+func (h *histogram) quantiles() (p50, p99, p999 uint64) {
+	var hist histogram
+	var total uint64
+	for i := range hist {
+		hist[i] = atomic.LoadUint64(&h[i])
+		total += hist[i]
+	}
+	return histQuantile(&hist, total, 500),
+		histQuantile(&hist, total, 990),
+		histQuantile(&hist, total, 999)
+}
+
+// histQuantile returns the bucket bound below which perMille of the
+// total samples fall.
+func histQuantile(hist *histogram, total, perMille uint64) uint64 {
+	if total == 0 {
+		return 0
+	}
+	rank := (total*perMille + 999) / 1000
+	var seen uint64
+	for b, n := range hist {
+		seen += n
+		if seen >= rank {
+			return histBucketMax(b)
+		}
+	}
+	return histBucketMax(histBuckets - 1)
+}
+
+type statsKey struct {
+	client    bool
+	component string
+	model     string
+	module    string
+	name      string
+}
+
+// The counters are only ever updated atomically, and are kept first so
+// they stay 64 bit aligned on 32 bit targets.
+type rpcStats struct {
+	calls    uint64
+	errors   uint64
+	bytesIn  uint64
+	bytesOut uint64
+	latency  histogram
+}
+
+// record accounts for one call that started at start. in and out are the
+// request and reply payload sizes.
+func (st *rpcStats) record(start time.Time, in, out int, failed bool) {
+	st.latency.add(time.Since(start))
+	atomic.AddUint64(&st.calls, 1)
+	if failed {
+		atomic.AddUint64(&st.errors, 1)
+	}
+	atomic.AddUint64(&st.bytesIn, uint64(in))
+	atomic.AddUint64(&st.bytesOut, uint64(out))
+}
+
+type rpcStatsSnapshot struct {
+	statsKey
+	calls, errors, bytesIn, bytesOut uint64
+	p50, p99, p999                   uint64
+}
+
+func (st *rpcStats) snapshot(key statsKey) rpcStatsSnapshot {
+	snap := rpcStatsSnapshot{
+		statsKey: key,
+		calls:    atomic.LoadUint64(&st.calls),
+		errors:   atomic.LoadUint64(&st.errors),
+		bytesIn:  atomic.LoadUint64(&st.bytesIn),
+		bytesOut: atomic.LoadUint64(&st.bytesOut),
+	}
+	snap.p50, snap.p99, snap.p999 = st.latency.quantiles()
+	return snap
+}
+
+var rpcStatsTable sync.Map // statsKey -> *rpcStats
+
+func rpcStatsFor(key statsKey) *rpcStats {
+	if st, ok := rpcStatsTable.Load(key); ok {
+		return st.(*rpcStats)
+	}
+	st, _ := rpcStatsTable.LoadOrStore(key, new(rpcStats))
+	return st.(*rpcStats)
+}
+
+func handlerStats(m *model, module, name string) *rpcStats {
+	return rpcStatsFor(statsKey{
+		component: m.component,
+		model:     m.name,
+		module:    module,
+		name:      name,
+	})
+}
+
+func clientStats(module, name string) *rpcStats {
+	return rpcStatsFor(statsKey{client: true, module: module, name: name})
+}
+
+// rpcStatsSnapshots returns the current statistics of every RPC seen
+// that passes filter, or of all of them if filter is nil.
+func rpcStatsSnapshots(filter func(statsKey) bool) []rpcStatsSnapshot {
+	var snaps []rpcStatsSnapshot
+	rpcStatsTable.Range(func(k, v interface{}) bool {
+		key := k.(statsKey)
+		if filter == nil || filter(key) {
+			snaps = append(snaps, v.(*rpcStats).snapshot(key))
+		}
+		return true
+	})
+	sort.Slice(snaps, func(i, j int) bool {
+		a, b := snaps[i].statsKey, snaps[j].statsKey
+		switch {
+		case a.client != b.client:
+			return !a.client
+		case a.component != b.component:
+			return a.component < b.component
+		case a.model != b.model:
+			return a.model < b.model
+		case a.module != b.module:
+			return a.module < b.module
+		}
+		return a.name < b.name
+	})
+	return snaps
+}
+
+// clientCall times a client RPC from the moment it is issued until its
+// reply is first collected. A call that could not be issued holds only
+// the reason in err.
+type clientCall struct {
+	*vci.RPCCall
+	stats    *rpcStats
+	start    time.Time
+	inputLen int
+	recorded uint32
+	enc      payloadEncoding
+	err      error
+}
+
+func newClientCall(client *vci.Client, module, name, input string) *clientCall {
+	return &clientCall{
+		stats:    clientStats(module, name),
+		start:    time.Now(),
+		inputLen: len(input),
+		RPCCall:  client.Call(module, name, input),
+	}
+}
+
+func (call *clientCall) StoreOutputInto(out *string) error {
+	if call.err != nil {
+		return call.err
+	}
+	err := call.RPCCall.StoreOutputInto(out)
+	if atomic.CompareAndSwapUint32(&call.recorded, 0, 1) {
+		call.stats.record(call.start, call.inputLen, len(*out), err != nil)
+	}
+	if err == nil && call.enc != encodingJSON {
+		var doc encodedString
+		if doc, err = call.enc.toC(encodedString(*out)); err != nil {
+			return encodingError(err)
+		}
+		*out = string(doc)
+	}
+	return err
+}
+
+// statsState publishes the statistics of a component's handlers, and of
+// the process's client calls, as the state of one of its models.
+type statsState struct {
+	component string
+}
+
+type statsEntry struct {
+	Direction   string `json:"direction"`
+	Model       string `json:"model"`
+	Module      string `json:"module"`
+	Name        string `json:"name"`
+	Calls       string `json:"calls"`
+	Errors      string `json:"errors"`
+	BytesIn     string `json:"bytes-in"`
+	BytesOut    string `json:"bytes-out"`
+	LatencyP50  string `json:"latency-p50"`
+	LatencyP99  string `json:"latency-p99"`
+	LatencyP999 string `json:"latency-p999"`
+}
+
+type admissionEntry struct {
+	Model       string `json:"model"`
+	Module      string `json:"module"`
+	Name        string `json:"name"`
+	MaxInFlight int    `json:"max-in-flight"`
+	MaxQueued   int    `json:"max-queued"`
+	InFlight    int    `json:"in-flight"`
+	Queued      int    `json:"queued"`
+	Admitted    string `json:"admitted"`
+	Rejected    string `json:"rejected"`
+	WaitP50     string `json:"wait-p50"`
+	WaitP99     string `json:"wait-p99"`
+	WaitP999    string `json:"wait-p999"`
+}
+
+func (state *statsState) Get() encodedString {
+	snaps := rpcStatsSnapshots(func(key statsKey) bool {
+		return key.client || key.component == state.component
+	})
+	entries := make([]statsEntry, 0, len(snaps))
+	for _, snap := range snaps {
+		direction := "handler"
+		if snap.client {
+			direction = "client"
+		}
+		// RFC 7951 encodes 64 bit integers as strings.
+		entries = append(entries, statsEntry{
+			Direction:   direction,
+			Model:       snap.model,
+			Module:      snap.module,
+			Name:        snap.name,
+			Calls:       strconv.FormatUint(snap.calls, 10),
+			Errors:      strconv.FormatUint(snap.errors, 10),
+			BytesIn:     strconv.FormatUint(snap.bytesIn, 10),
+			BytesOut:    strconv.FormatUint(snap.bytesOut, 10),
+			LatencyP50:  strconv.FormatUint(snap.p50, 10),
+			LatencyP99:  strconv.FormatUint(snap.p99, 10),
+			LatencyP999: strconv.FormatUint(snap.p999, 10),
+		})
+	}
+	keys, gates := limitedGates(state.component)
+	admissions := make([]admissionEntry, len(keys))
+	for i, key := range keys {
+		snap := &gates[i]
+		admissions[i] = admissionEntry{
+			Model:       key.model,
+			Module:      key.module,
+			Name:        key.name,
+			MaxInFlight: snap.maxInFlight,
+			MaxQueued:   snap.maxQueued,
+			InFlight:    snap.inFlight,
+			Queued:      snap.queued,
+			Admitted:    strconv.FormatUint(snap.admitted, 10),
+			Rejected:    strconv.FormatUint(snap.rejected, 10),
+			WaitP50:     strconv.FormatUint(snap.p50, 10),
+			WaitP99:     strconv.FormatUint(snap.p99, 10),
+			WaitP999:    strconv.FormatUint(snap.p999, 10),
+		}
+	}
+	out, _ := json.Marshal(map[string]interface{}{
+		"vyatta-vci-stats-v1:rpc-statistics": map[string]interface{}{
+			"rpc": entries,
+		},
+		"vyatta-vci-stats-v1:admission-statistics": map[string]interface{}{
+			"gate": admissions,
+		},
+	})
+	return encodedString(out)
+}
+
+func cRPCStatsArray(p *C.vci_rpc_stats, n int) []C.vci_rpc_stats {
+	if n == 0 {
+		return nil
+	}
+	return (*[maxCRPCStats]C.vci_rpc_stats)(unsafe.Pointer(p))[:n:n]
+}
+
+//export _vci_stats_snapshot
+func _vci_stats_snapshot(stats **C.vci_rpc_stats, count *C.size_t) C.int {
+	snaps := rpcStatsSnapshots(nil)
+	if len(snaps) > maxCRPCStats {
+		snaps = snaps[:maxCRPCStats]
+	}
+	*stats, *count = nil, 0
+	if len(snaps) == 0 {
+		return 0
+	}
+	p := (*C.vci_rpc_stats)(C.calloc(C.size_t(len(snaps)),
+		C.size_t(unsafe.Sizeof(C.vci_rpc_stats{}))))
+	if p == nil {
+		return -1
+	}
+	outs := cRPCStatsArray(p, len(snaps))
+	for i := range outs {
+		out, snap := &outs[i], &snaps[i]
+		out.component = C.CString(snap.component)
+		out.model = C.CString(snap.model)
+		out.module = C.CString(snap.module)
+		out.name = C.CString(snap.name)
+		if snap.client {
+			out.client = 1
+		}
+		out.calls = C.uint64_t(snap.calls)
+		out.errors = C.uint64_t(snap.errors)
+		out.bytes_in = C.uint64_t(snap.bytesIn)
+		out.bytes_out = C.uint64_t(snap.bytesOut)
+		out.latency_p50_ns = C.uint64_t(snap.p50)
+		out.latency_p99_ns = C.uint64_t(snap.p99)
+		out.latency_p999_ns = C.uint64_t(snap.p999)
+	}
+	*stats, *count = p, C.size_t(len(snaps))
+	return 0
+}
@@ -0,0 +1,477 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+/*
+#include <stdint.h>
+#include "../vci.h"
+*/
+import "C"
+import (
+	"log"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/danos/vci"
+)
+
+/*
+Client subscriptions deliver through a queue owned by this library rather
+than relying on the vci package's own, so that the limits applied through
+vci_subscription_* can be observed. The vci package hands each
+notification to enqueue, which applies the subscription's policy, and a
+goroutine started whenever the queue goes from empty to non-empty drains
+it into the subscriber in order. The vci subscription is set to block
+once a single notification is outstanding, so a queue blocked here holds
+the bus back just as the vci package's blocking limit did.
+
+A batch subscriber is handed whatever is waiting, up to batchMax
+notifications at a time, in one call. When batchDelay is set a drain
+that finds less than a full batch waits that long for it to fill before
+delivering what it has; a producer that fills the batch, or is blocked
+by the queue's limit, cuts the wait short, and a queue already at its
+limit is not kept waiting at all.
+*/
+
+// defaultBatchMax is the batch size used when the subscriber leaves it
+// to us.
+const defaultBatchMax = 64
+
+type queuePolicy int
+
+const (
+	queueUnlimited queuePolicy = iota
+	queueDrop
+	queueBlock
+	queueCoalesce
+	queueCoalesceKey
+)
+
+type subscriptionQueue struct {
+	// Kept first so that it is 64 bit aligned on 32 bit targets.
+	callback histogram
+
+	deliver func(encodedString)
+
+	// deliverBatch returns how many of the batch it could not deliver,
+	// which count as dropped.
+	deliverBatch func([]encodedString) int
+	batchMax     int
+	batchDelay   time.Duration
+	batch        []encodedString
+	full         chan struct{}
+
+	// Set once the application dispatches notifications itself.
+	dispatcher *dispatcher
+
+	mu       sync.Mutex
+	notFull  sync.Cond
+	pending  []encodedString
+	head     int
+	policy   queuePolicy
+	limit    int
+	draining bool
+
+	// For queueBlock, producers are held once the queue reaches limit
+	// and let go once it has drained to resume.
+	resume  int
+	holding bool
+
+	// For queueCoalesceKey, the key of each keyed notification waiting
+	// and where it waits, as the count of notifications popped before it.
+	keyPath jsonPath
+	keySeq  map[string]uint64
+	seqKey  map[uint64]string
+	popped  uint64
+
+	highWater   uint64
+	delivered   uint64
+	dropped     uint64
+	coalesced   uint64
+	blocked     uint64
+	blockedTime time.Duration
+}
+
+func newSubscriptionQueue(deliver func(encodedString)) *subscriptionQueue {
+	q := &subscriptionQueue{deliver: deliver}
+	q.notFull.L = &q.mu
+	return q
+}
+
+func newBatchSubscriptionQueue(
+	deliver func([]encodedString) int,
+	max int,
+	delay time.Duration,
+) *subscriptionQueue {
+	if max <= 0 {
+		max = defaultBatchMax
+	}
+	q := &subscriptionQueue{
+		deliverBatch: deliver,
+		batchMax:     max,
+		batchDelay:   delay,
+		full:         make(chan struct{}, 1),
+	}
+	q.notFull.L = &q.mu
+	return q
+}
+
+// depth is the number of notifications waiting. Called with q.mu held.
+func (q *subscriptionQueue) depth() int {
+	return len(q.pending) - q.head
+}
+
+// push appends a notification, reusing the space ahead of head once the
+// backing array is full. Called with q.mu held.
+func (q *subscriptionQueue) push(in encodedString) {
+	if q.head > 0 && len(q.pending) == cap(q.pending) {
+		n := copy(q.pending, q.pending[q.head:])
+		for i := n; i < len(q.pending); i++ {
+			q.pending[i] = nil
+		}
+		q.pending = q.pending[:n]
+		q.head = 0
+	}
+	q.pending = append(q.pending, in)
+	if depth := uint64(q.depth()); depth > q.highWater {
+		q.highWater = depth
+	}
+}
+
+// pop removes the oldest notification. Called with q.mu held.
+func (q *subscriptionQueue) pop() encodedString {
+	if key, ok := q.seqKey[q.popped]; ok {
+		delete(q.seqKey, q.popped)
+		delete(q.keySeq, key)
+	}
+	q.popped++
+	in := q.pending[q.head]
+	q.pending[q.head] = nil
+	q.head++
+	if q.head == len(q.pending) {
+		q.pending = q.pending[:0]
+		q.head = 0
+	}
+	return in
+}
+
+func (q *subscriptionQueue) enqueue(in encodedString) {
+	q.mu.Lock()
+	defer q.mu.Unlock()
+	switch q.policy {
+	case queueCoalesce:
+		if q.depth() > 0 {
+			q.pending[len(q.pending)-1] = in
+			q.coalesced++
+			return
+		}
+	case queueCoalesceKey:
+		if key, ok := q.keyPath.key(in); ok {
+			if seq, ok := q.keySeq[key]; ok {
+				q.pending[q.head+int(seq-q.popped)] = in
+				q.coalesced++
+				return
+			}
+			seq := q.popped + uint64(q.depth())
+			q.keySeq[key] = seq
+			q.seqKey[seq] = key
+		}
+	case queueDrop:
+		if q.depth() >= q.limit {
+			q.dropped++
+			return
+		}
+	case queueBlock:
+		if q.depth() >= q.limit {
+			q.holding = true
+		}
+		if q.holding {
+			q.signalFull()
+			q.blocked++
+			start := time.Now()
+			for q.policy == queueBlock && q.holding {
+				q.notFull.Wait()
+				// Producers let go together refill the queue, and the
+				// first to find it back at the limit holds the rest.
+				if q.policy == queueBlock && q.depth() >= q.limit {
+					q.holding = true
+					q.signalFull()
+				}
+			}
+			q.blockedTime += time.Since(start)
+		}
+	}
+	q.push(in)
+	if q.full != nil && q.depth() >= q.batchMax {
+		q.signalFull()
+	}
+	if !q.draining {
+		q.draining = true
+		go q.drain()
+	}
+}
+
+// signalFull ends a batch drain's wait for more notifications. Called
+// with q.mu held.
+func (q *subscriptionQueue) signalFull() {
+	if q.full == nil {
+		return
+	}
+	select {
+	case q.full <- struct{}{}:
+	default:
+	}
+}
+
+// atLimit reports whether the queue has reached its limit, when waiting
+// for a batch to fill would only drop notifications or hold producers
+// back. Called with q.mu held.
+func (q *subscriptionQueue) atLimit() bool {
+	switch q.policy {
+	case queueDrop, queueBlock:
+		return q.holding || q.depth() >= q.limit
+	}
+	return false
+}
+
+// waitForBatch gives a partial batch up to batchDelay to fill. Called
+// with q.mu held, which it drops while waiting. A signal left over from
+// an earlier batch is not cleared first, as it may be a held producer's:
+// at worst it cuts this wait short.
+func (q *subscriptionQueue) waitForBatch() {
+	q.mu.Unlock()
+	timer := time.NewTimer(q.batchDelay)
+	select {
+	case <-q.full:
+	case <-timer.C:
+	}
+	timer.Stop()
+	q.mu.Lock()
+}
+
+func (q *subscriptionQueue) drainBatches() {
+	q.mu.Lock()
+	for q.depth() > 0 {
+		if q.batchDelay > 0 && q.depth() < q.batchMax && !q.atLimit() {
+			q.waitForBatch()
+		}
+		batch := q.batch[:0]
+		for len(batch) < q.batchMax && q.depth() > 0 {
+			batch = append(batch, q.pop())
+		}
+		d := q.dispatcher
+		// Counted up front, so that a dispatcher's thread finding it
+		// could not deliver some never takes the count below zero.
+		q.delivered += uint64(len(batch))
+		q.release()
+		q.mu.Unlock()
+		lost := 0
+		if d != nil {
+			for _, in := range batch {
+				d.push(in)
+			}
+		} else {
+			start := time.Now()
+			lost = q.deliverBatch(batch)
+			q.callback.add(time.Since(start))
+		}
+		for i := range batch {
+			batch[i] = nil
+		}
+		q.mu.Lock()
+		q.batch = batch
+		q.delivered -= uint64(lost)
+		q.dropped += uint64(lost)
+	}
+	q.draining = false
+	q.mu.Unlock()
+}
+
+func (q *subscriptionQueue) drain() {
+	if q.deliverBatch != nil {
+		q.drainBatches()
+		return
+	}
+	q.mu.Lock()
+	for q.depth() > 0 {
+		in := q.pop()
+		d := q.dispatcher
+		// Counted up front, as for a batch, so that a subscriber that
+		// loses it never takes the count below zero.
+		q.delivered++
+		q.release()
+		q.mu.Unlock()
+		if d != nil {
+			d.push(in)
+		} else {
+			start := time.Now()
+			q.deliver(in)
+			q.callback.add(time.Since(start))
+		}
+		q.mu.Lock()
+	}
+	q.draining = false
+	q.mu.Unlock()
+}
+
+// lose counts n notifications already counted as delivered as dropped
+// instead, for a subscriber that could not deliver them.
+func (q *subscriptionQueue) lose(n int) {
+	q.mu.Lock()
+	q.delivered -= uint64(n)
+	q.dropped += uint64(n)
+	q.mu.Unlock()
+}
+
+// release lets held producers go once the queue has drained to the low
+// watermark. Called with q.mu held.
+func (q *subscriptionQueue) release() {
+	if !q.holding || q.depth() > q.resume {
+		return
+	}
+	q.holding = false
+	q.notFull.Broadcast()
+}
+
+func (q *subscriptionQueue) setPolicy(policy queuePolicy, limit int) {
+	q.setWatermarks(policy, limit, limit-1)
+}
+
+// setWatermarks sets policy, with queueBlock holding producers from when
+// the queue reaches high until it has drained to low.
+func (q *subscriptionQueue) setWatermarks(policy queuePolicy, high, low int) {
+	if policy == queueBlock && high < 1 {
+		high = 1
+	}
+	if low >= high {
+		low = high - 1
+	}
+	if low < 0 {
+		low = 0
+	}
+	q.mu.Lock()
+	q.policy, q.limit, q.resume = policy, high, low
+	q.holding = false
+	q.keyPath, q.keySeq, q.seqKey = nil, nil, nil
+	q.notFull.Broadcast()
+	q.mu.Unlock()
+}
+
+// coalesceByKey keeps one waiting notification per value at path.
+func (q *subscriptionQueue) coalesceByKey(path string) error {
+	keyPath, err := parseJSONPath(path)
+	if err != nil {
+		return err
+	}
+	q.mu.Lock()
+	q.policy, q.limit = queueCoalesceKey, 0
+	q.holding = false
+	q.keyPath = keyPath
+	q.keySeq = make(map[string]uint64)
+	q.seqKey = make(map[uint64]string)
+	q.notFull.Broadcast()
+	q.mu.Unlock()
+	return nil
+}
+
+func (q *subscriptionQueue) stats(out *C.vci_subscription_statistics) {
+	q.mu.Lock()
+	out.depth = C.uint64_t(q.depth())
+	out.high_water = C.uint64_t(q.highWater)
+	out.delivered = C.uint64_t(q.delivered)
+	out.dropped = C.uint64_t(q.dropped)
+	out.coalesced = C.uint64_t(q.coalesced)
+	out.blocked = C.uint64_t(q.blocked)
+	out.blocked_ns = C.uint64_t(q.blockedTime)
+	q.mu.Unlock()
+	p50, p99, p999 := q.callback.quantiles()
+	out.callback_p50_ns = C.uint64_t(p50)
+	out.callback_p99_ns = C.uint64_t(p99)
+	out.callback_p999_ns = C.uint64_t(p999)
+}
+
+type subscription struct {
+	*vci.Subscription
+	queue    *subscriptionQueue
+	encoding uint32 // payloadEncoding
+
+	// Logs the first notification that could not be transcoded.
+	badDoc sync.Once
+}
+
+func newSubscription(
+	client *vci.Client,
+	module, name string,
+	deliver func(encodedString),
+) *subscription {
+	s := &subscription{}
+	s.queue = newSubscriptionQueue(func(in encodedString) {
+		enc := payloadEncoding(atomic.LoadUint32(&s.encoding))
+		// A notification that cannot be transcoded is dropped.
+		doc, err := enc.toC(in)
+		if err != nil {
+			s.transcodeFailed(module, name, err)
+			s.queue.lose(1)
+			return
+		}
+		deliver(doc)
+	})
+	s.subscribe(client, module, name)
+	return s
+}
+
+func newBatchSubscription(
+	client *vci.Client,
+	module, name string,
+	deliver func([]encodedString) int,
+	max int,
+	delay time.Duration,
+) *subscription {
+	s := &subscription{}
+	var docs []encodedString
+	s.queue = newBatchSubscriptionQueue(func(batch []encodedString) int {
+		enc := payloadEncoding(atomic.LoadUint32(&s.encoding))
+		if enc == encodingJSON {
+			return deliver(batch)
+		}
+		docs = docs[:0]
+		for _, in := range batch {
+			doc, err := enc.toC(in)
+			if err != nil {
+				s.transcodeFailed(module, name, err)
+				continue
+			}
+			docs = append(docs, doc)
+		}
+		lost := len(batch) - len(docs)
+		if len(docs) > 0 {
+			lost += deliver(docs)
+		}
+		for i := range docs {
+			docs[i] = nil
+		}
+		return lost
+	}, max, delay)
+	s.subscribe(client, module, name)
+	return s
+}
+
+func (s *subscription) subscribe(client *vci.Client, module, name string) {
+	s.Subscription = client.Subscribe(module, name, s.queue.enqueue)
+	s.BlockAfterLimit(1)
+}
+
+func (s *subscription) transcodeFailed(module, name string, err error) {
+	s.badDoc.Do(func() {
+		log.Printf("vci: subscription %s/%s: dropping notifications "+
+			"that cannot be transcoded: %s", module, name, err)
+	})
+}
+
+func (s *subscription) setEncoding(enc payloadEncoding) {
+	atomic.StoreUint32(&s.encoding, uint32(enc))
+}
@@ -0,0 +1,283 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+package main
+
+import (
+	"strconv"
+	"sync"
+	"testing"
+	"time"
+)
+
+// slowSubscriber checks that each producer's notifications arrive once
+// and in order, taking its time over some of them, and closes done once
+// total have arrived.
+func slowSubscriber(t *testing.T, producers, total int, done chan struct{}) func(encodedString) {
+	var mu sync.Mutex
+	next := make([]int, producers)
+	delivered := 0
+	return func(in encodedString) {
+		p, n := decodeStress(in)
+		mu.Lock()
+		if n != next[p] {
+			t.Errorf("producer %d: got %d, want %d", p, n, next[p])
+		}
+		next[p] = n + 1
+		delivered++
+		if delivered == total {
+			close(done)
+		}
+		mu.Unlock()
+		if n%50 == 0 {
+			time.Sleep(100 * time.Microsecond)
+		}
+	}
+}
+
+func waitDelivered(t *testing.T, done chan struct{}) {
+	select {
+	case <-done:
+	case <-time.After(30 * time.Second):
+		t.Fatal("notifications were lost")
+	}
+}
+
+// TestBlockWatermarksStress floods a slow subscriber from several
+// producers and checks that nothing is lost and that the queue, and the
+// memory behind it, stay bounded by the high watermark.
+func TestBlockWatermarksStress(t *testing.T) {
+	const (
+		producers = 8
+		each      = 5000
+		high      = 64
+		low       = 16
+	)
+	done := make(chan struct{})
+	q := newSubscriptionQueue(
+		slowSubscriber(t, producers, producers*each, done))
+	q.setWatermarks(queueBlock, high, low)
+
+	var wg sync.WaitGroup
+	for p := 0; p < producers; p++ {
+		wg.Add(1)
+		go func(p int) {
+			defer wg.Done()
+			for n := 0; n < each; n++ {
+				q.enqueue(encodeStress(p, n))
+			}
+		}(p)
+	}
+	wg.Wait()
+	waitDelivered(t, done)
+
+	q.mu.Lock()
+	defer q.mu.Unlock()
+	if q.highWater > high {
+		t.Errorf("queue reached %d, above the high watermark %d",
+			q.highWater, high)
+	}
+	if cap(q.pending) > 2*high {
+		t.Errorf("queue grew to %d entries for a high watermark of %d",
+			cap(q.pending), high)
+	}
+	if q.blocked == 0 || q.blockedTime == 0 {
+		t.Error("producers were never held")
+	}
+}
+
+// TestBlockWatermarksResume checks that a held producer is only let go
+// once the queue has drained to the low watermark.
+func TestBlockWatermarksResume(t *testing.T) {
+	const (
+		each = 5000
+		high = 64
+		low  = 16
+	)
+	done := make(chan struct{})
+	q := newSubscriptionQueue(slowSubscriber(t, 1, each, done))
+	q.setWatermarks(queueBlock, high, low)
+
+	held := 0
+	for n := 0; n < each; n++ {
+		q.mu.Lock()
+		before := q.blocked
+		q.mu.Unlock()
+		q.enqueue(encodeStress(0, n))
+		q.mu.Lock()
+		if q.blocked != before {
+			held++
+			// The drain may have moved on, but nothing else has pushed.
+			if depth := q.depth(); depth > low+1 {
+				t.Errorf("resumed with %d waiting", depth)
+			}
+		}
+		q.mu.Unlock()
+	}
+	waitDelivered(t, done)
+	if held == 0 {
+		t.Error("the producer was never held")
+	}
+}
+
+func encodeStress(p, n int) encodedString {
+	return encodedString(strconv.Itoa(p) + " " + strconv.Itoa(n))
+}
+
+func decodeStress(in encodedString) (int, int) {
+	s := string(in)
+	for i := range s {
+		if s[i] == ' ' {
+			p, _ := strconv.Atoi(s[:i])
+			n, _ := strconv.Atoi(s[i+1:])
+			return p, n
+		}
+	}
+	return -1, -1
+}
+
+// TestBatchDelayUnderLimit checks that a batch subscriber whose limit is
+// below its batch size is not kept waiting out the delay while producers
+// are held at the limit.
+func TestBatchDelayUnderLimit(t *testing.T) {
+	const (
+		each  = 200
+		limit = 4
+		delay = 10 * time.Second
+	)
+	done := make(chan struct{})
+	deliver := slowSubscriber(t, 1, each, done)
+	q := newBatchSubscriptionQueue(func(batch []encodedString) int {
+		if len(batch) > limit {
+			t.Errorf("batch of %d above the limit %d", len(batch), limit)
+		}
+		for _, in := range batch {
+			deliver(in)
+		}
+		return 0
+	}, 64, delay)
+	q.setPolicy(queueBlock, limit)
+
+	start := time.Now()
+	go func() {
+		for n := 0; n < each; n++ {
+			q.enqueue(encodeStress(0, n))
+		}
+	}()
+	select {
+	case <-done:
+	case <-time.After(delay):
+		t.Fatal("batches waited out the delay")
+	}
+	if elapsed := time.Since(start); elapsed > delay/2 {
+		t.Errorf("took %s to deliver %d notifications", elapsed, each)
+	}
+}
+
+// TestBatchLostCountsDropped checks that notifications a batch subscriber
+// could not deliver are counted as dropped rather than delivered.
+func TestBatchLostCountsDropped(t *testing.T) {
+	q := newBatchSubscriptionQueue(func(batch []encodedString) int {
+		return len(batch) / 2
+	}, 4, 0)
+	q.draining = true
+	for n := 0; n < 8; n++ {
+		q.enqueue(encodeStress(0, n))
+	}
+	q.drain()
+	if q.delivered != 4 || q.dropped != 4 {
+		t.Errorf("delivered %d, dropped %d, want 4 and 4",
+			q.delivered, q.dropped)
+	}
+}
+
+// TestLostCountsDropped checks the same for a subscriber that loses
+// single notifications, as one does that cannot transcode them.
+func TestLostCountsDropped(t *testing.T) {
+	var q *subscriptionQueue
+	n := 0
+	q = newSubscriptionQueue(func(encodedString) {
+		if n++; n%2 == 0 {
+			q.lose(1)
+		}
+	})
+	q.draining = true
+	for n := 0; n < 8; n++ {
+		q.enqueue(encodeStress(0, n))
+	}
+	q.drain()
+	if q.delivered != 4 || q.dropped != 4 {
+		t.Errorf("delivered %d, dropped %d, want 4 and 4",
+			q.delivered, q.dropped)
+	}
+}
+
+// TestBlockWatermarksRecheck holds more producers than there is room for
+// between the watermarks and checks that letting them go at the low
+// watermark does not take the queue past the high one.
+func TestBlockWatermarksRecheck(t *testing.T) {
+	const (
+		producers = 10
+		high      = 4
+		low       = 0
+	)
+	q := newSubscriptionQueue(func(encodedString) {})
+	q.setWatermarks(queueBlock, high, low)
+	// Drain by hand, so that the queue only moves when told to.
+	q.draining = true
+	for n := 0; n < high; n++ {
+		q.enqueue(encodeStress(0, n))
+	}
+	var wg sync.WaitGroup
+	for p := 1; p <= producers; p++ {
+		wg.Add(1)
+		go func(p int) {
+			defer wg.Done()
+			q.enqueue(encodeStress(p, 0))
+		}(p)
+	}
+	waitFor := func(cond func() bool) {
+		for deadline := time.Now().Add(10 * time.Second); ; {
+			q.mu.Lock()
+			ok := cond()
+			q.mu.Unlock()
+			if ok {
+				return
+			}
+			if time.Now().After(deadline) {
+				t.Fatal("timed out")
+			}
+			time.Sleep(time.Millisecond)
+		}
+	}
+	waitFor(func() bool { return q.blocked == producers })
+
+	popAll := func() int {
+		q.mu.Lock()
+		defer q.mu.Unlock()
+		n := q.depth()
+		for q.depth() > 0 {
+			q.pop()
+		}
+		q.release()
+		return n
+	}
+	popAll()
+	waitFor(func() bool { return q.depth() >= high })
+	// Give any producer that failed to recheck the limit time to push.
+	time.Sleep(50 * time.Millisecond)
+	delivered := 0
+	for delivered < producers {
+		q.mu.Lock()
+		if depth := q.depth(); depth > high {
+			t.Fatalf("queue reached %d, above the high watermark %d",
+				depth, high)
+		}
+		q.mu.Unlock()
+		delivered += popAll()
+		time.Sleep(time.Millisecond)
+	}
+	wg.Wait()
+}
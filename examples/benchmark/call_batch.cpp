@@ -0,0 +1,68 @@
+// Copyright (c) 2021, AT&T Intellectual Property.
+// All rights reserved.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+
+// Compares issuing the same RPC one call at a time with issuing it in
+// batches through vci::Client::call_batch. Run against the C++ example
+// component:
+//
+//   vci-batch-benchmark [calls] [batch-size]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <vci.hpp>
+
+static const std::string module = "cppexample";
+static const std::string rpc = "rpc1";
+static const std::string input = "{\"foo\":\"bar\"}";
+
+template <typename Fn>
+static void
+report(const std::string &name, size_t calls, Fn fn)
+{
+	auto start = std::chrono::steady_clock::now();
+	fn();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		elapsed).count();
+	std::cout << name << "\t" << calls << " calls\t"
+			  << ns / calls << " ns/call" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	size_t calls = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 10000;
+	size_t batch = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 100;
+	if (calls == 0 || batch == 0) {
+		std::cerr << "usage: " << argv[0] << " [calls] [batch-size]"
+				  << std::endl;
+		return 1;
+	}
+	try {
+		vci::Client client;
+		report("serial", calls, [&]() {
+			for (size_t i = 0; i < calls; i++) {
+				client.call(module, rpc, input)->output();
+			}
+		});
+		std::vector<vci::EncodedInput> inputs(batch, input);
+		report("batch/" + std::to_string(batch), calls, [&]() {
+			for (size_t done = 0; done < calls; done += batch) {
+				if (calls - done < batch) {
+					inputs.resize(calls - done);
+				}
+				for (const auto &res : client.call_batch(module, rpc, inputs)) {
+					res.output();
+				}
+			}
+		});
+	} catch (const vci::Exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2021, AT&T Intellectual Property.
+# All rights reserved.
+#
+# SPDX-License-Identifier: LGPL-2.1-only
+
+# Measures the per call cost of converting payloads between Python
+# objects and JSON in the Python bindings. "before" reproduces what the
+# bindings used to do for every input, output and notification: run
+# "import json" and then json.loads/json.dumps through freshly compiled
+# source strings. "after" is the native codec the bindings now use.
+
+import json
+import sys
+import timeit
+
+import vci
+
+
+def legacy_decode(encoded_data):
+    scope = {'encoded_data': encoded_data}
+    exec('import json', globals(), scope)
+    return eval('json.loads(encoded_data)', globals(), scope)
+
+
+def legacy_encode(obj_to_encode):
+    scope = {'obj_to_encode': obj_to_encode}
+    exec('import json', globals(), scope)
+    return eval('json.dumps(obj_to_encode)', globals(), scope)
+
+
+PAYLOADS = {
+    'small': {'foo': 'bar'},
+    'interfaces': {
+        'interfaces': [
+            {'name': 'dp0p%ds1' % i, 'mtu': 1500, 'enabled': True,
+             'address': ['10.%d.0.1/24' % i, '2001:db8:%x::1/64' % i],
+             'counters': {'rx-packets': i * 1000003, 'tx-packets': i * 7,
+                          'rx-rate': i * 0.5}}
+            for i in range(100)
+        ]
+    },
+}
+
+
+def bench(name, fn, arg, number):
+    per_call = timeit.timeit(lambda: fn(arg), number=number) / number
+    print('%-28s %10.2f us/call' % (name, per_call * 1e6))
+
+
+def main():
+    number = int(sys.argv[1]) if len(sys.argv) > 1 else 10000
+    for name, obj in PAYLOADS.items():
+        encoded = json.dumps(obj)
+        assert vci._decode_object(encoded) == obj
+        assert json.loads(vci._encode_object(obj)) == obj
+        bench(name + ' decode before', legacy_decode, encoded, number)
+        bench(name + ' decode after', vci._decode_object, encoded, number)
+        bench(name + ' encode before', legacy_encode, obj, number)
+        bench(name + ' encode after', vci._encode_object, obj, number)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+
+# Copyright (c) 2021, AT&T Intellectual Property.
+# All rights reserved.
+#
+# SPDX-License-Identifier: LGPL-2.1-only
+
+# Checks that Python threads keep running while others are blocked in the
+# library. It registers the py3example component itself, so run it in
+# place of examples/python3/py3example.py:
+#
+#   py3threads.py [threads] [calls-per-thread]
+#
+# rpc1 sleeps in its handler and rpc2 calls rpc1 from inside its handler.
+# Each is driven first from one thread and then from several. If blocking
+# calls held the GIL the threaded run would take as long as the serial one
+# and rpc2 would never complete.
+
+import sys
+import threading
+import time
+
+import vci
+
+MODULE = 'py3example'
+DELAY = 0.01
+INPUT = {'foo': 'bar'}
+
+client = None
+
+
+def slow(input):
+    time.sleep(DELAY)
+    return input
+
+
+def nested(input):
+    return client.call(MODULE, 'rpc1', input).output()
+
+
+def run(threads, calls, rpc):
+    def worker():
+        c = vci.Client()
+        for _ in range(calls):
+            c.call(MODULE, rpc, INPUT).output()
+
+    workers = [threading.Thread(target=worker) for _ in range(threads)]
+    start = time.monotonic()
+    for w in workers:
+        w.start()
+    for w in workers:
+        w.join()
+    return time.monotonic() - start
+
+
+def main():
+    global client
+    threads = int(sys.argv[1]) if len(sys.argv) > 1 else 8
+    calls = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+    total = threads * calls
+
+    comp = (vci.Component('net.vyatta.vci.py3example')
+            .model(vci.Model('net.vyatta.vci.py3example.v1')
+                   .rpc(MODULE, 'rpc1', slow)
+                   .rpc(MODULE, 'rpc2', nested))
+            .run())
+    client = comp.client()
+
+    ok = True
+    for rpc in ('rpc1', 'rpc2'):
+        serial = run(1, total, rpc)
+        parallel = run(threads, calls, rpc)
+        print('%s: 1 thread %.0f calls/s, %d threads %.0f calls/s (%.1fx)' % (
+            rpc, total / serial, threads, total / parallel,
+            serial / parallel))
+        # Allow plenty of slack, serialised callers would be close to 1x.
+        if threads > 1 and serial / parallel < 2:
+            ok = False
+
+    comp.stop()
+    if not ok:
+        print('threads did not run concurrently')
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
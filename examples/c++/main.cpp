@@ -57,6 +57,10 @@ int main() {
 				   .rpc("cppexample", "lambda",
 						[](const std::string &in)->std::string {
 							return in;
+						})
+				   .rpc<std::string, std::string>("cppexample", "typed",
+						[](const std::string &in) {
+							return in; //Through vci::Codec
 						}))
 			.subscribe("toaster", "toast-done",
 					   [](const std::string &in) {
@@ -26,41 +26,60 @@ std::string perl_str_to_string(SV *obj) {
 	if (obj == NULL) {
 		return "";
 	}
-	return SvPV_nolen(obj);
+	STRLEN len;
+	const char *str = SvPV(obj, len);
+	return std::string(str, len);
 }
 
-SV *perl_call_json_single(const char *sub_name, SV *input) {
+SV *perl_call_json_method(SV *coder, const char *method, SV *arg) {
 	// See "perlcall" for the particulars regarding this.
-	SV *output;
+	SV *output = NULL;
 	int count;
-	load_module(0, newSVpv("JSON", 4), NULL, (SV*) NULL);
 	dSP;						// initialize stack pointer
 	ENTER;						// enter a scope
 	SAVETMPS;					// save temporaries
 	PUSHMARK(SP);				// save the stack pointer
-	EXTEND(SP, 1);				// make the stack larger by one
-	PUSHs(input);				// push the SV onto the stack
-	PUTBACK;					// make the stack pointer global
-	count = call_pv(sub_name, G_SCALAR); // call the function
-	if (count != 1){
-		// TODO: throw an error
+	EXTEND(SP, 2);				// make the stack larger by two
+	PUSHs(coder);				// push the invocant onto the stack
+	if (arg != NULL) {
+		PUSHs(arg);				// push the SV onto the stack
 	}
+	PUTBACK;					// make the stack pointer global
+	count = call_method(method, G_SCALAR); // call the method
 	SPAGAIN;					// refresh the stack pointer
-	output = newSVsv(POPs);		// pop the variable
+	if (count == 1) {
+		output = newSVsv(POPs);	// pop the variable
+	}
 	PUTBACK;					// make stack pointer global
 	FREETMPS;					// free any temporaries
 	LEAVE;						// leave the created scope
 	return output;
 }
 
+// All conversions share one coder, built the first time it is needed,
+// instead of loading JSON and going through to_json/from_json each time.
+// It works on UTF-8 bytes, which is what crosses the bus.
+SV *perl_json_coder() {
+	static SV *coder = NULL;
+	if (coder != NULL) {
+		return coder;
+	}
+	load_module(PERL_LOADMOD_NOIMPORT, newSVpvs("JSON"), NULL);
+	SV *json = perl_call_json_method(sv_2mortal(newSVpvs("JSON")), "new", NULL);
+	SvREFCNT_dec(perl_call_json_method(json, "utf8", NULL));
+	SvREFCNT_dec(perl_call_json_method(json, "allow_nonref", NULL));
+	coder = json;
+	return coder;
+}
+
 SV *perl_decode_object(const std::string &encoded_input) {
-	const char *from_json = "from_json";
-	SV *input = newSVpv(encoded_input.c_str(), encoded_input.length());
-	return perl_call_json_single(from_json, sv_2mortal(input));
+	SV *input = newSVpvn(encoded_input.data(), encoded_input.length());
+	return perl_call_json_method(
+		perl_json_coder(), "decode", sv_2mortal(input));
 }
 
 std::string perl_encode_object(SV *obj) {
-	const char *to_json = "to_json";
-	OwnedPerlObject output = perl_call_json_single(to_json, obj);
+	OwnedPerlObject output = perl_call_json_method(
+		perl_json_coder(), "encode", obj);
 	return perl_str_to_string(output.get());
 }
@@ -14,27 +14,86 @@
 %include "std_string.i"
 %include "std_except.i"
 
+%exception {
+	try {
+		$action
+	} catch (const vci::Exception &ex) {
+		SWIG_croak(ex.what().c_str());
+	} catch (const std::exception &ex) {
+		SWIG_croak(ex.what());
+	}
+}
+
 namespace vci {
+	 %ignore Buffer;
+	 %ignore BufferState;
+	 %ignore BufferMethod;
+	 %ignore BufferMethodMeta;
 	 %ignore Config;
 	 %ignore State;
+	 %ignore CachedConfig;
+	 %ignore CachedState;
+	 %ignore DeltaConfig;
 	 %ignore Method;
 	 %ignore Component;
 	 %ignore Model;
 	 %ignore Subscription;
+	 %ignore SubscriptionStats;
 	 %ignore Subscriber;
 	 %ignore RPCCall;
+	 // Subscribers would be called on library threads, which Perl
+	 // cannot run on.
 	 %ignore Client::subscribe;
 	 %ignore Client::call;
-	 %ignore Client::config_by_model;
-	 %ignore Client::state_by_model;
+	 %rename(call) Client::call_output;
+	 %ignore Client::call_async;
+	 %ignore Client::call_batch;
+	 %ignore Client::read_config_by_model;
+	 %ignore Client::read_state_by_model;
+	 %ignore Client::subscribe_batch;
+	 %ignore Client::executor;
+	 %ignore Component::executor;
+	 %ignore Executor;
+	 %ignore Encoding;
+	 %ignore Model::encoding;
+	 %ignore Subscription::encoding;
+	 %ignore Client::call(const std::string&, const std::string&, const EncodedInput&, Encoding);
+	 %ignore Client::emit(const std::string&, const std::string&, const EncodedInput&, Encoding);
+	 %ignore RPCResult;
+	 %ignore StateWriter;
+	 %ignore StreamingState;
+	 %ignore PreparedConfig;
+	 %ignore EncodedView;
+	 %ignore ViewConfig;
+	 %ignore ViewMethod;
+	 %ignore ViewMethodMeta;
+	 %ignore ViewSubscriber;
+	 %ignore operator==(EncodedView, EncodedView);
+	 %ignore operator!=(EncodedView, EncodedView);
+	 %ignore MethodMeta::operator()(EncodedView, EncodedView, Buffer&);
+	 %ignore Codec;
+	 %ignore TypedMethod;
+	 %ignore RPCStats;
+	 %ignore stats_snapshot;
 
-	 %typemap(in) const EncodedInput & (int res = 0){
-		auto str = perl_encode_object($input);
-		$1 = new std::string(str); //SWIG frees this
+	 %typemap(in) const EncodedInput & (std::string tmp) {
+		tmp = perl_encode_object($input);
+		$1 = &tmp;
 	 }
 
 	 %typemap(out) EncodedOutput {
-		$result = perl_decode_object($1);
+		$result = sv_2mortal(perl_decode_object($1));
+		argvi++;
+	 }
+
+	 // RPCCall is not wrapped, so the Perl call waits for the output
+	 // and returns it.
+	 %extend Client {
+		 EncodedOutput call_output(
+			 const std::string& module, const std::string& name,
+			 const EncodedInput& input) {
+			 return $self->call(module, name, input)->output();
+		 }
 	 }
 }
 
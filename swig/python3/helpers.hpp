@@ -4,6 +4,10 @@
 // SPDX-License-Identifier: LGPL-2.1-only
 
 #include <Python.h>
+#include <ctype.h>
+#include <string.h>
+#include <cmath>
+#include <string>
 #include "../../vci.hpp"
 
 class OwnedPyObject {
@@ -15,6 +19,10 @@ public:
 		Py_XDECREF(_obj);
 	}
 	PyObject *get() { return _obj; }
+	void reset() {
+		Py_XDECREF(_obj);
+		_obj = NULL;
+	}
 private:
 	PyObject *_obj;
 };
@@ -58,37 +66,557 @@ std::string py_str_to_string(PyObject *obj) {
 	return out;
 }
 
-PyObject *py_decode_object(const std::string &encoded_input) {
-	PyObject* main = PyImport_AddModule("__main__");//Borrowed ref
-	PyObject* globals = PyModule_GetDict(main); //Borrowed ref
-	OwnedPyObject locals = PyDict_New();
-	OwnedPyObject value = PyString_FromString(encoded_input.c_str());
-	PyDict_SetItemString(locals.get(), "encoded_data", value.get());
+/*
+ * Payloads are converted between Python objects and JSON text natively.
+ * Anything outside the plain JSON data model (custom types, non string
+ * dictionary keys, NaN, lone surrogates, unparsable input, ...) is handed
+ * to the json module's dumps/loads, looked up once and cached, so results
+ * and errors match what json would produce.
+ */
+
+static const int py_json_max_depth = 512;
 
-	OwnedPyObject impret = PyRun_String(
-		"import json", Py_single_input, globals, locals.get());
+PyObject *py_json_callable(const char *name) {
+	// Returns a borrowed reference to json.<name>, cached for the life of
+	// the interpreter.
+	static PyObject *json_module = NULL;
+	if (json_module == NULL) {
+		json_module = PyImport_ImportModule("json");
+		if (json_module == NULL) {
+			return NULL;
+		}
+	}
+	static PyObject *dumps = NULL;
+	static PyObject *loads = NULL;
+	PyObject **fn = strcmp(name, "dumps") == 0 ? &dumps : &loads;
+	if (*fn == NULL) {
+		*fn = PyObject_GetAttrString(json_module, name);
+	}
+	return *fn;
+}
 
-	PyObject* output = PyRun_String(
-		"json.loads(encoded_data)", Py_eval_input, globals, locals.get());
+bool py_json_encode(PyObject *obj, std::string &out, int depth);
 
-	PyDict_Clear(locals.get());
-	return output;
+bool py_json_encode_fallback(PyObject *obj, std::string &out) {
+	PyObject *dumps = py_json_callable("dumps");
+	if (dumps == NULL) {
+		return false;
+	}
+	OwnedPyObject encoded = PyObject_CallFunctionObjArgs(dumps, obj, NULL);
+	if (encoded.get() == NULL) {
+		return false;
+	}
+	Py_ssize_t len;
+	const char *str = PyUnicode_AsUTF8AndSize(encoded.get(), &len);
+	if (str == NULL) {
+		return false;
+	}
+	out.append(str, len);
+	return true;
 }
 
-std::string py_encode_object(PyObject *obj) {
-	PyObject* main = PyImport_AddModule("__main__");//Borrowed ref
-	PyObject* globals = PyModule_GetDict(main); //Borrowed ref
-	OwnedPyObject locals = PyDict_New();
-	PyDict_SetItemString(locals.get(), "obj_to_encode", obj);
+bool py_json_encode_string(PyObject *obj, std::string &out) {
+	static const char hex[] = "0123456789abcdef";
+	Py_ssize_t len;
+	const char *str = PyUnicode_AsUTF8AndSize(obj, &len);
+	if (str == NULL) {
+		// Lone surrogates have no UTF-8 form, json escapes them.
+		PyErr_Clear();
+		return py_json_encode_fallback(obj, out);
+	}
+	out.push_back('"');
+	Py_ssize_t run = 0;
+	for (Py_ssize_t i = 0; i < len; i++) {
+		unsigned char c = str[i];
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+		out.append(str + run, i - run);
+		run = i + 1;
+		switch (c) {
+		case '"': out.append("\\\""); break;
+		case '\\': out.append("\\\\"); break;
+		case '\n': out.append("\\n"); break;
+		case '\r': out.append("\\r"); break;
+		case '\t': out.append("\\t"); break;
+		case '\b': out.append("\\b"); break;
+		case '\f': out.append("\\f"); break;
+		default:
+			out.append("\\u00");
+			out.push_back(hex[c >> 4]);
+			out.push_back(hex[c & 0xf]);
+		}
+	}
+	out.append(str + run, len - run);
+	out.push_back('"');
+	return true;
+}
 
-	OwnedPyObject impret = PyRun_String(
-		"import json", Py_single_input, globals, locals.get());
+bool py_json_encode_number(PyObject *obj, std::string &out) {
+	if (PyLong_Check(obj)) {
+		int overflow;
+		long long value = PyLong_AsLongLongAndOverflow(obj, &overflow);
+		if (overflow == 0) {
+			if (value == -1 && PyErr_Occurred()) {
+				return false;
+			}
+			out.append(std::to_string(value));
+			return true;
+		}
+		OwnedPyObject digits = PyNumber_ToBase(obj, 10);
+		if (digits.get() == NULL) {
+			return false;
+		}
+		out.append(py_str_to_string(digits.get()));
+		return true;
+	}
+	double value = PyFloat_AS_DOUBLE(obj);
+	if (!std::isfinite(value)) {
+		return py_json_encode_fallback(obj, out);
+	}
+	char *repr = PyOS_double_to_string(value, 'r', 0, Py_DTSF_ADD_DOT_0, NULL);
+	if (repr == NULL) {
+		return false;
+	}
+	out.append(repr);
+	PyMem_Free(repr);
+	return true;
+}
 
-	OwnedPyObject output = PyRun_String(
-		"json.dumps(obj_to_encode)", Py_eval_input, globals, locals.get());
+bool py_json_encode_dict(PyObject *obj, std::string &out, int depth) {
+	Py_ssize_t pos = 0;
+	PyObject *key, *value; // Borrowed refs
+	while (PyDict_Next(obj, &pos, &key, &value)) {
+		if (!PyUnicode_Check(key)) {
+			// json has its own rules for coercing keys.
+			return py_json_encode_fallback(obj, out);
+		}
+	}
+	out.push_back('{');
+	pos = 0;
+	bool first = true;
+	while (PyDict_Next(obj, &pos, &key, &value)) {
+		if (!first) {
+			out.push_back(',');
+		}
+		first = false;
+		if (!py_json_encode_string(key, out)) {
+			return false;
+		}
+		out.push_back(':');
+		if (!py_json_encode(value, out, depth + 1)) {
+			return false;
+		}
+	}
+	out.push_back('}');
+	return true;
+}
 
-	auto out = py_str_to_string(output.get());
-	PyDict_Clear(locals.get());
+bool py_json_encode_sequence(PyObject *obj, std::string &out, int depth) {
+	bool is_list = PyList_Check(obj);
+	Py_ssize_t len = is_list ? PyList_GET_SIZE(obj) : PyTuple_GET_SIZE(obj);
+	out.push_back('[');
+	for (Py_ssize_t i = 0; i < len; i++) {
+		if (i != 0) {
+			out.push_back(',');
+		}
+		PyObject *item = is_list ? PyList_GET_ITEM(obj, i)
+			: PyTuple_GET_ITEM(obj, i); // Borrowed ref
+		if (!py_json_encode(item, out, depth + 1)) {
+			return false;
+		}
+	}
+	out.push_back(']');
+	return true;
+}
+
+bool py_json_encode(PyObject *obj, std::string &out, int depth) {
+	if (depth > py_json_max_depth) {
+		// Let json report circular references and deep nesting.
+		return py_json_encode_fallback(obj, out);
+	}
+	if (obj == Py_None) {
+		out.append("null");
+		return true;
+	}
+	if (PyBool_Check(obj)) {
+		out.append(obj == Py_True ? "true" : "false");
+		return true;
+	}
+	if (PyUnicode_Check(obj)) {
+		return py_json_encode_string(obj, out);
+	}
+	if (PyLong_Check(obj) || PyFloat_Check(obj)) {
+		return py_json_encode_number(obj, out);
+	}
+	if (PyDict_Check(obj)) {
+		return py_json_encode_dict(obj, out, depth);
+	}
+	if (PyList_Check(obj) || PyTuple_Check(obj)) {
+		return py_json_encode_sequence(obj, out, depth);
+	}
+	return py_json_encode_fallback(obj, out);
+}
+
+class PyJSONDecoder {
+	// Recursive descent parser producing Python objects. Returns NULL
+	// with no Python error set when the input needs the json module.
+public:
+	PyJSONDecoder(const char *data, size_t len)
+		: _p(data), _end(data + len) {}
+	PyObject *decode() {
+		PyObject *out = this->value(0);
+		if (out == NULL) {
+			return NULL;
+		}
+		this->skip_space();
+		if (this->_p != this->_end) {
+			Py_DECREF(out);
+			return NULL;
+		}
+		return out;
+	}
+private:
+	const char *_p;
+	const char *_end;
+	std::string _scratch;
+
+	void skip_space() {
+		while (this->_p != this->_end &&
+			   (*this->_p == ' ' || *this->_p == '\t' ||
+				*this->_p == '\n' || *this->_p == '\r')) {
+			this->_p++;
+		}
+	}
+
+	bool literal(const char *word, size_t len) {
+		if ((size_t)(this->_end - this->_p) < len ||
+			memcmp(this->_p, word, len) != 0) {
+			return false;
+		}
+		this->_p += len;
+		return true;
+	}
+
+	PyObject *value(int depth) {
+		if (depth > py_json_max_depth) {
+			return NULL;
+		}
+		this->skip_space();
+		if (this->_p == this->_end) {
+			return NULL;
+		}
+		switch (*this->_p) {
+		case '{':
+			return this->object(depth);
+		case '[':
+			return this->array(depth);
+		case '"':
+			return this->string();
+		case 't':
+			if (this->literal("true", 4)) {
+				Py_RETURN_TRUE;
+			}
+			return NULL;
+		case 'f':
+			if (this->literal("false", 5)) {
+				Py_RETURN_FALSE;
+			}
+			return NULL;
+		case 'n':
+			if (this->literal("null", 4)) {
+				Py_RETURN_NONE;
+			}
+			return NULL;
+		default:
+			return this->number();
+		}
+	}
+
+	PyObject *object(int depth) {
+		this->_p++;
+		OwnedPyObject out = PyDict_New();
+		if (out.get() == NULL) {
+			return NULL;
+		}
+		this->skip_space();
+		if (this->_p != this->_end && *this->_p == '}') {
+			this->_p++;
+			Py_INCREF(out.get());
+			return out.get();
+		}
+		for (;;) {
+			this->skip_space();
+			if (this->_p == this->_end || *this->_p != '"') {
+				return NULL;
+			}
+			OwnedPyObject key = this->string();
+			if (key.get() == NULL) {
+				return NULL;
+			}
+			this->skip_space();
+			if (this->_p == this->_end || *this->_p != ':') {
+				return NULL;
+			}
+			this->_p++;
+			OwnedPyObject item = this->value(depth + 1);
+			if (item.get() == NULL ||
+				PyDict_SetItem(out.get(), key.get(), item.get()) != 0) {
+				return NULL;
+			}
+			this->skip_space();
+			if (this->_p == this->_end) {
+				return NULL;
+			}
+			if (*this->_p == '}') {
+				this->_p++;
+				Py_INCREF(out.get());
+				return out.get();
+			}
+			if (*this->_p != ',') {
+				return NULL;
+			}
+			this->_p++;
+		}
+	}
+
+	PyObject *array(int depth) {
+		this->_p++;
+		OwnedPyObject out = PyList_New(0);
+		if (out.get() == NULL) {
+			return NULL;
+		}
+		this->skip_space();
+		if (this->_p != this->_end && *this->_p == ']') {
+			this->_p++;
+			Py_INCREF(out.get());
+			return out.get();
+		}
+		for (;;) {
+			OwnedPyObject item = this->value(depth + 1);
+			if (item.get() == NULL ||
+				PyList_Append(out.get(), item.get()) != 0) {
+				return NULL;
+			}
+			this->skip_space();
+			if (this->_p == this->_end) {
+				return NULL;
+			}
+			if (*this->_p == ']') {
+				this->_p++;
+				Py_INCREF(out.get());
+				return out.get();
+			}
+			if (*this->_p != ',') {
+				return NULL;
+			}
+			this->_p++;
+		}
+	}
+
+	static bool is_digit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	static int hex_value(char c) {
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	bool hex4(unsigned int *out) {
+		if (this->_end - this->_p < 4) {
+			return false;
+		}
+		*out = 0;
+		for (int i = 0; i < 4; i++) {
+			int v = hex_value(this->_p[i]);
+			if (v < 0) {
+				return false;
+			}
+			*out = (*out << 4) | v;
+		}
+		this->_p += 4;
+		return true;
+	}
+
+	void append_utf8(unsigned int cp) {
+		if (cp < 0x80) {
+			this->_scratch.push_back(cp);
+		} else if (cp < 0x800) {
+			this->_scratch.push_back(0xc0 | (cp >> 6));
+			this->_scratch.push_back(0x80 | (cp & 0x3f));
+		} else if (cp < 0x10000) {
+			this->_scratch.push_back(0xe0 | (cp >> 12));
+			this->_scratch.push_back(0x80 | ((cp >> 6) & 0x3f));
+			this->_scratch.push_back(0x80 | (cp & 0x3f));
+		} else {
+			this->_scratch.push_back(0xf0 | (cp >> 18));
+			this->_scratch.push_back(0x80 | ((cp >> 12) & 0x3f));
+			this->_scratch.push_back(0x80 | ((cp >> 6) & 0x3f));
+			this->_scratch.push_back(0x80 | (cp & 0x3f));
+		}
+	}
+
+	bool escape() {
+		if (this->_p == this->_end) {
+			return false;
+		}
+		char c = *this->_p++;
+		switch (c) {
+		case '"': case '\\': case '/':
+			this->_scratch.push_back(c);
+			return true;
+		case 'b': this->_scratch.push_back('\b'); return true;
+		case 'f': this->_scratch.push_back('\f'); return true;
+		case 'n': this->_scratch.push_back('\n'); return true;
+		case 'r': this->_scratch.push_back('\r'); return true;
+		case 't': this->_scratch.push_back('\t'); return true;
+		case 'u':
+			break;
+		default:
+			return false;
+		}
+		unsigned int cp;
+		if (!this->hex4(&cp)) {
+			return false;
+		}
+		if (cp >= 0xdc00 && cp <= 0xdfff) {
+			// Lone low surrogate, only json can represent it.
+			return false;
+		}
+		if (cp >= 0xd800 && cp <= 0xdbff) {
+			unsigned int low;
+			if (!this->literal("\\u", 2) || !this->hex4(&low) ||
+				low < 0xdc00 || low > 0xdfff) {
+				return false;
+			}
+			cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+		}
+		this->append_utf8(cp);
+		return true;
+	}
+
+	PyObject *string() {
+		this->_p++;
+		const char *start = this->_p;
+		while (this->_p != this->_end && *this->_p != '"' &&
+			   *this->_p != '\\') {
+			if ((unsigned char)*this->_p < 0x20) {
+				return NULL;
+			}
+			this->_p++;
+		}
+		if (this->_p == this->_end) {
+			return NULL;
+		}
+		if (*this->_p == '"') {
+			this->_p++;
+			return PyUnicode_DecodeUTF8(start, this->_p - start - 1, NULL);
+		}
+		this->_scratch.assign(start, this->_p - start);
+		while (this->_p != this->_end && *this->_p != '"') {
+			char c = *this->_p++;
+			if (c == '\\') {
+				if (!this->escape()) {
+					return NULL;
+				}
+			} else if ((unsigned char)c < 0x20) {
+				return NULL;
+			} else {
+				this->_scratch.push_back(c);
+			}
+		}
+		if (this->_p == this->_end) {
+			return NULL;
+		}
+		this->_p++;
+		return PyUnicode_DecodeUTF8(
+			this->_scratch.data(), this->_scratch.size(), NULL);
+	}
+
+	PyObject *number() {
+		const char *start = this->_p;
+		bool is_float = false;
+		if (this->_p != this->_end && *this->_p == '-') {
+			this->_p++;
+		}
+		const char *digits = this->_p;
+		while (this->_p != this->_end && is_digit(*this->_p)) {
+			this->_p++;
+		}
+		size_t ndigits = this->_p - digits;
+		if (ndigits == 0 || (ndigits > 1 && *digits == '0')) {
+			return NULL;
+		}
+		if (this->_p != this->_end && *this->_p == '.') {
+			is_float = true;
+			this->_p++;
+			const char *frac = this->_p;
+			while (this->_p != this->_end && is_digit(*this->_p)) {
+				this->_p++;
+			}
+			if (this->_p == frac) {
+				return NULL;
+			}
+		}
+		if (this->_p != this->_end && (*this->_p == 'e' || *this->_p == 'E')) {
+			is_float = true;
+			this->_p++;
+			if (this->_p != this->_end && (*this->_p == '+' || *this->_p == '-')) {
+				this->_p++;
+			}
+			const char *exp = this->_p;
+			while (this->_p != this->_end && is_digit(*this->_p)) {
+				this->_p++;
+			}
+			if (this->_p == exp) {
+				return NULL;
+			}
+		}
+		if (!is_float && ndigits <= 18) {
+			long long value = 0;
+			for (const char *d = digits; d != this->_p; d++) {
+				value = value * 10 + (*d - '0');
+			}
+			return PyLong_FromLongLong(*start == '-' ? -value : value);
+		}
+		std::string text(start, this->_p - start);
+		if (!is_float) {
+			return PyLong_FromString(text.c_str(), NULL, 10);
+		}
+		double value = PyOS_string_to_double(text.c_str(), NULL, NULL);
+		if (value == -1.0 && PyErr_Occurred()) {
+			return NULL;
+		}
+		return PyFloat_FromDouble(value);
+	}
+};
+
+PyObject *py_decode_object(const std::string &encoded_input) {
+	PyJSONDecoder decoder(encoded_input.data(), encoded_input.size());
+	PyObject *output = decoder.decode();
+	if (output != NULL || PyErr_Occurred() != NULL) {
+		return output;
+	}
+	PyObject *loads = py_json_callable("loads");
+	if (loads == NULL) {
+		return NULL;
+	}
+	OwnedPyObject value = PyUnicode_FromStringAndSize(
+		encoded_input.data(), encoded_input.size());
+	if (value.get() == NULL) {
+		return NULL;
+	}
+	return PyObject_CallFunctionObjArgs(loads, value.get(), NULL);
+}
+
+std::string py_encode_object(PyObject *obj) {
+	std::string out;
+	if (!py_json_encode(obj, out, 0)) {
+		return "";
+	}
 	return out;
 }
 
@@ -147,6 +675,11 @@ void py_handle_ex() {
 class PyMethod : public vci::Method {
 public:
 	PyMethod(PyObject *func) : _func(func) {}
+	~PyMethod() {
+		// Handlers are freed on library threads.
+		auto gil = GILEnsure();
+		this->_func.reset();
+	}
 	std::string operator()(const std::string &encoded_input) {
 		auto gil = GILEnsure();
 		OwnedPyObject inobj = py_decode_object(encoded_input);
@@ -169,6 +702,11 @@ vci::Method *py_gen_method(PyObject *func) {
 class PyMethodMeta : public vci::MethodMeta {
 public:
 	PyMethodMeta(PyObject *func) : _func(func) {}
+	~PyMethodMeta() {
+		// Handlers are freed on library threads.
+		auto gil = GILEnsure();
+		this->_func.reset();
+	}
 	std::string operator()(const std::string &encoded_meta,
 						   const std::string &encoded_input) {
 		auto gil = GILEnsure();
@@ -193,6 +731,11 @@ vci::MethodMeta *py_gen_method_meta(PyObject *func) {
 class PySubscriber : public vci::Subscriber {
 public:
 	PySubscriber(PyObject *func) : _func(func) {}
+	~PySubscriber() {
+		// Handlers are freed on library threads.
+		auto gil = GILEnsure();
+		this->_func.reset();
+	}
 	void operator()(const std::string &encoded_input) {
 		auto gil = GILEnsure();
 		OwnedPyObject inobj = py_decode_object(encoded_input);
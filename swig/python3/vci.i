@@ -3,7 +3,7 @@
 //
 // SPDX-License-Identifier: LGPL-2.1-only
 
-%module(directors="1") vci
+%module(directors="1", threads="1") vci
 
 %{
 #define SWIG_FILE_WITH_INIT
@@ -15,11 +15,28 @@
 %include "std_shared_ptr.i"
 %include "std_except.i"
 %include "exception.i"
+%include "stdint.i"
+%include "std_vector.i"
 
 %shared_ptr(vci::RPCCall);
 %shared_ptr(vci::Subscription);
 %shared_ptr(vci::Client);
 
+// Calls into the library run without the GIL so that a thread blocked in
+// Component.wait(), RPCCall.output(), Client.state_by_model() and the like
+// does not stall other Python threads, nor the handlers the library calls
+// back on its own threads. Calls that only touch local state keep the GIL
+// and skip the release.
+%nothreadallow vci::Exception::Exception;
+%nothreadallow vci::Exception::app_tag;
+%nothreadallow vci::Exception::info;
+%nothreadallow vci::Exception::path;
+%nothreadallow vci::Exception::what;
+%nothreadallow vci::Model::Model;
+%nothreadallow vci::Model::config;
+%nothreadallow vci::Model::state;
+%nothreadallow vci::Model::rpc;
+
 %feature("director:except") {
 	if ($error != NULL) {
 		py_handle_ex();
@@ -46,10 +63,89 @@ namespace vci {
 
 	 %feature("director") Config;
 	 %feature("director") State;
+	 %feature("director") CachedConfig;
+	 %feature("director") CachedState;
+	 %feature("director") DeltaConfig;
 	 %feature("director") Method;
 	 %feature("director") MethodMeta;
 	 %feature("director") Subscriber;
 
+	 // The Buffer writing overloads are a C++ only fast path, Python
+	 // handlers always return their result.
+	 %ignore Buffer;
+	 %ignore BufferState;
+	 %ignore BufferMethod;
+	 %ignore BufferMethodMeta;
+	 %ignore Config::get(Buffer&);
+	 %ignore State::get(Buffer&);
+	 %ignore CachedConfig::get(Buffer&);
+	 %ignore CachedState::get(Buffer&);
+	 %ignore DeltaConfig::get(Buffer&);
+	 %ignore Method::operator()(const EncodedInput&, Buffer&);
+	 %ignore MethodMeta::operator()(const EncodedInput&, const EncodedInput&, Buffer&);
+	 %feature("nodirector") Config::get(Buffer&);
+	 %feature("nodirector") State::get(Buffer&);
+	 %feature("nodirector") CachedConfig::get(Buffer&);
+	 %feature("nodirector") CachedState::get(Buffer&);
+	 %feature("nodirector") DeltaConfig::get(Buffer&);
+	 %feature("nodirector") Method::operator()(const EncodedInput&, Buffer&);
+	 %feature("nodirector") MethodMeta::operator()(const EncodedInput&, const EncodedInput&, Buffer&);
+
+	 // So are the overloads taking an EncodedView, which hand Python
+	 // handlers a copy through the original forms.
+	 %ignore EncodedView;
+	 %ignore ViewConfig;
+	 %ignore ViewMethod;
+	 %ignore ViewMethodMeta;
+	 %ignore ViewSubscriber;
+	 %ignore operator==(EncodedView, EncodedView);
+	 %ignore operator!=(EncodedView, EncodedView);
+	 %ignore Config::set(EncodedView);
+	 %ignore Config::check(EncodedView);
+	 %ignore CachedConfig::set(EncodedView);
+	 %ignore CachedConfig::check(EncodedView);
+	 %ignore DeltaConfig::set(EncodedView);
+	 %ignore DeltaConfig::check(EncodedView);
+	 %ignore DeltaConfig::set_delta(EncodedView);
+	 %ignore Method::operator()(EncodedView, Buffer&);
+	 %ignore MethodMeta::operator()(EncodedView, EncodedView, Buffer&);
+	 %ignore Subscriber::operator()(EncodedView);
+	 %feature("nodirector") Config::set(EncodedView);
+	 %feature("nodirector") Config::check(EncodedView);
+	 %feature("nodirector") CachedConfig::set(EncodedView);
+	 %feature("nodirector") CachedConfig::check(EncodedView);
+	 %feature("nodirector") DeltaConfig::set(EncodedView);
+	 %feature("nodirector") DeltaConfig::check(EncodedView);
+	 %feature("nodirector") DeltaConfig::set_delta(EncodedView);
+	 %feature("nodirector") Method::operator()(EncodedView, Buffer&);
+	 %feature("nodirector") MethodMeta::operator()(EncodedView, EncodedView, Buffer&);
+	 %feature("nodirector") Subscriber::operator()(EncodedView);
+
+	 // The asynchronous, batched and chunked calls have no Python mapping.
+	 %ignore Client::call_async;
+	 %ignore Client::call_batch;
+	 %ignore Client::read_config_by_model;
+	 %ignore Client::read_state_by_model;
+	 %ignore Client::subscribe_batch;
+	 %ignore Client::executor;
+	 %ignore Component::executor;
+	 %ignore Executor;
+	 %ignore RPCResult;
+	 // CBOR payloads have no Python mapping.
+	 %ignore Encoding;
+	 %ignore Model::encoding;
+	 %ignore Subscription::encoding;
+	 %ignore Client::call(const std::string&, const std::string&, const EncodedInput&, Encoding);
+	 %ignore Client::emit(const std::string&, const std::string&, const EncodedInput&, Encoding);
+	 // The typed templates are for C++ codecs.
+	 %ignore Codec;
+	 %ignore TypedMethod;
+	 // Streaming state is a C++ only fast path.
+	 %ignore StateWriter;
+	 %ignore StreamingState;
+	 // A prepared token has no Python mapping.
+	 %ignore PreparedConfig;
+
 	 %typemap(directorout) EncodedOutput {
 		 // Convert from a python object to a string using the
 		 // JSON package
@@ -152,6 +248,31 @@ namespace vci {
 
 %include "../../vci.hpp"
 
+%template(RPCStatsList) std::vector<vci::RPCStats>;
+
+// The payload codec, exposed for benchmarking and debugging. These touch
+// Python objects so they must keep the GIL.
+%feature("nothreadallow") _encode_object;
+%feature("nothreadallow") _decode_object;
+%inline %{
+PyObject *_encode_object(PyObject *obj) {
+	std::string out = py_encode_object(obj);
+	if (PyErr_Occurred() != NULL) {
+		return NULL;
+	}
+	return PyUnicode_FromStringAndSize(out.data(), out.size());
+}
+
+PyObject *_decode_object(PyObject *str) {
+	Py_ssize_t len;
+	const char *data = PyUnicode_AsUTF8AndSize(str, &len);
+	if (data == NULL) {
+		return NULL;
+	}
+	return py_decode_object(std::string(data, len));
+}
+%}
+
 %pythoncode {
 	class Exception(__builtin__.Exception, _vci_exception):
 		def __init__(self, app_tag, info, path, *args):
@@ -3,6 +3,7 @@
 //
 // SPDX-License-Identifier: LGPL-2.1-only
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -28,6 +29,54 @@ vci_error_string(vci_error *error)
 	return _vci_error_string(error);
 }
 
+void
+vci_buf_init(vci_buf *buf)
+{
+	buf->data = NULL;
+	buf->len = 0;
+	buf->cap = 0;
+}
+
+int
+vci_buf_reserve(vci_buf *buf, size_t len)
+{
+	if (buf->cap - buf->len >= len) {
+		return 0;
+	}
+	if (len > SIZE_MAX / 2 - buf->len) {
+		return -1;
+	}
+	size_t cap = buf->cap != 0 ? buf->cap : 64;
+	while (cap - buf->len < len) {
+		cap *= 2;
+	}
+	char *data = realloc(buf->data, cap);
+	if (data == NULL) {
+		return -1;
+	}
+	buf->data = data;
+	buf->cap = cap;
+	return 0;
+}
+
+int
+vci_buf_append(vci_buf *buf, const void *data, size_t len)
+{
+	if (vci_buf_reserve(buf, len) != 0) {
+		return -1;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
+void
+vci_buf_free(vci_buf *buf)
+{
+	free(buf->data);
+	vci_buf_init(buf);
+}
+
 struct vci_component {
 	uint64_t cd;
 };
@@ -49,6 +98,44 @@ struct vci_subscription {
 	uint64_t sd;
 };
 
+struct vci_state_writer {
+	uint64_t wd;
+};
+
+struct vci_executor {
+	uint64_t ed;
+};
+
+vci_executor *
+vci_executor_new(const char *name, size_t threads)
+{
+	vci_executor *exec = malloc(sizeof(vci_executor));
+	if (exec == NULL) {
+		return exec;
+	}
+	exec->ed = _vci_executor_new((char *)name, threads);
+	return exec;
+}
+
+void
+vci_executor_run(vci_executor *exec)
+{
+	_vci_executor_run(exec->ed);
+}
+
+void
+vci_executor_stop(vci_executor *exec)
+{
+	_vci_executor_stop(exec->ed);
+}
+
+void
+vci_executor_free(vci_executor *exec)
+{
+	_vci_executor_free(exec->ed);
+	free(exec);
+}
+
 vci_component *
 vci_component_new(const char *name)
 {
@@ -114,6 +201,26 @@ vci_component_subscribe(vci_component* comp,
 									err);
 }
 
+int
+vci_component_subscribe_v2(vci_component* comp,
+						   const char *module_name,
+						   const char *notification_name,
+						   const vci_subscriber_object_v2* subscriber,
+						   vci_error *err)
+{
+	return _vci_component_subscribe_v2(comp->cd, (char *) module_name,
+									   (char *) notification_name,
+									   (vci_subscriber_object_v2 *) subscriber,
+									   err);
+}
+
+void
+vci_component_set_executor(vci_component *comp, vci_executor *exec,
+						   size_t ring_size)
+{
+	_vci_component_set_executor(comp->cd, exec ? exec->ed : 0, ring_size);
+}
+
 int
 vci_component_unsubscribe(vci_component* comp,
 						  const char *module_name,
@@ -137,6 +244,29 @@ vci_component_model(vci_component *comp,
 	return mod;
 }
 
+int
+vci_state_writer_write(vci_state_writer *w, const void *data, size_t len)
+{
+	return _vci_state_writer_write(w->wd, (void *) data, len);
+}
+
+int
+vci_state_writer_reserve(vci_state_writer *w, size_t len)
+{
+	int rc = _vci_state_writer_reserve(w->wd, len);
+	if (rc < 0) {
+		errno = -rc;
+		return -1;
+	}
+	return 0;
+}
+
+void
+vci_state_writer_fail(vci_state_writer *w)
+{
+	_vci_state_writer_fail(w->wd);
+}
+
 void
 vci_model_config(vci_model *model, const vci_config_object* config)
 {
@@ -165,6 +295,77 @@ vci_model_rpc_meta(vci_model *model, const char *module_name,
 				   (vci_rpc_meta_object*) rpc);
 }
 
+void
+vci_model_config_v2(vci_model *model, const vci_config_object_v2* config)
+{
+	_vci_model_config_v2(model->md, (vci_config_object_v2*) config);
+}
+
+void
+vci_model_state_v2(vci_model *model, const vci_state_object_v2* state)
+{
+	_vci_model_state_v2(model->md, (vci_state_object_v2*) state);
+}
+
+void
+vci_model_rpc_v2(vci_model *model, const char *module_name,
+				 const char * rpc_name, const vci_rpc_object_v2* rpc)
+{
+	_vci_model_rpc_v2(model->md, (char *)module_name, (char *)rpc_name,
+					  (vci_rpc_object_v2*) rpc);
+}
+
+void
+vci_model_rpc_meta_v2(vci_model *model, const char *module_name,
+					  const char * rpc_name, const vci_rpc_meta_object_v2* rpc)
+{
+	_vci_model_rpc_meta_v2(model->md, (char *)module_name, (char *)rpc_name,
+						   (vci_rpc_meta_object_v2*) rpc);
+}
+
+void
+vci_model_stats(vci_model *model)
+{
+	_vci_model_stats(model->md);
+}
+
+int
+vci_model_set_encoding(vci_model *model, vci_encoding enc)
+{
+	return _vci_model_set_encoding(model->md, enc);
+}
+
+void
+vci_model_set_admission(vci_model *model,
+						uint32_t max_in_flight, uint32_t max_queued)
+{
+	_vci_model_set_admission(model->md, max_in_flight, max_queued);
+}
+
+void
+vci_model_set_rpc_admission(vci_model *model,
+							const char *module, const char *name,
+							uint32_t max_in_flight, uint32_t max_queued)
+{
+	_vci_model_set_rpc_admission(model->md, (char*)module, (char*)name,
+								 max_in_flight, max_queued);
+}
+
+void
+vci_model_admission_stats(vci_model *model, vci_admission_statistics *stats)
+{
+	_vci_model_admission_stats(model->md, stats);
+}
+
+void
+vci_model_rpc_admission_stats(vci_model *model,
+							  const char *module, const char *name,
+							  vci_admission_statistics *stats)
+{
+	_vci_model_rpc_admission_stats(model->md, (char*)module, (char*)name,
+								   stats);
+}
+
 void
 vci_model_free(vci_model *model)
 {
@@ -202,6 +403,27 @@ vci_client_emit(vci_client *client,
 		client->cd, (char*)module, (char*)name, (char*)data, err);
 }
 
+int
+vci_client_emit_v2(vci_client *client,
+				   const char *module, const char *name,
+				   const void *data, size_t data_len, vci_error *err)
+{
+	return _vci_client_emit_v2(
+		client->cd, (char*)module, (char*)name, (void*)data, data_len, err);
+}
+
+int
+vci_client_emit_encoded(vci_client *client,
+						const char *module, const char *name,
+						vci_encoding enc,
+						const void *data, size_t data_len,
+						vci_error *err)
+{
+	return _vci_client_emit_encoded(
+		client->cd, (char*)module, (char*)name, enc,
+		(void*)data, data_len, err);
+}
+
 int
 vci_client_store_config_by_model_into(
 	vci_client *client , const char *model, char **output, vci_error *err)
@@ -210,6 +432,15 @@ vci_client_store_config_by_model_into(
 		client->cd, (char*)model, output, err);
 }
 
+int
+vci_client_store_config_by_model_into_v2(
+	vci_client *client, const char *model,
+	void **output, size_t *output_len, vci_error *err)
+{
+	return _vci_client_store_config_by_model_into_v2(
+		client->cd, (char*)model, output, output_len, err);
+}
+
 int
 vci_client_store_state_by_model_into(
 	vci_client *client ,const char *model, char **output, vci_error *err)
@@ -218,6 +449,33 @@ vci_client_store_state_by_model_into(
 		client->cd, (char*)model, output, err);
 }
 
+int
+vci_client_store_state_by_model_into_v2(
+	vci_client *client, const char *model,
+	void **output, size_t *output_len, vci_error *err)
+{
+	return _vci_client_store_state_by_model_into_v2(
+		client->cd, (char*)model, output, output_len, err);
+}
+
+int
+vci_client_read_config_by_model(
+	vci_client *client, const char *model, size_t chunk_size,
+	vci_chunk_reader reader, void *ctx, vci_error *err)
+{
+	return _vci_client_read_config_by_model(
+		client->cd, (char*)model, chunk_size, reader, ctx, err);
+}
+
+int
+vci_client_read_state_by_model(
+	vci_client *client, const char *model, size_t chunk_size,
+	vci_chunk_reader reader, void *ctx, vci_error *err)
+{
+	return _vci_client_read_state_by_model(
+		client->cd, (char*)model, chunk_size, reader, ctx, err);
+}
+
 
 vci_rpccall *
 vci_client_call(vci_client *client,
@@ -233,6 +491,70 @@ vci_client_call(vci_client *client,
 	return out;
 }
 
+vci_rpccall *
+vci_client_call_v2(vci_client *client,
+				   const char *module, const char *name,
+				   const void *input, size_t input_len)
+{
+	vci_rpccall *out = malloc(sizeof(vci_rpccall));
+	if (out == NULL) {
+		return NULL;
+	}
+	out->rd = _vci_client_call_v2(
+		client->cd, (char*)module, (char*)name, (void*)input, input_len);
+	return out;
+}
+
+vci_rpccall *
+vci_client_call_encoded(vci_client *client,
+						const char *module, const char *name,
+						vci_encoding enc,
+						const void *input, size_t input_len)
+{
+	vci_rpccall *out = malloc(sizeof(vci_rpccall));
+	if (out == NULL) {
+		return NULL;
+	}
+	out->rd = _vci_client_call_encoded(
+		client->cd, (char*)module, (char*)name, enc,
+		(void*)input, input_len);
+	return out;
+}
+
+void
+vci_client_call_async(vci_client *client,
+					  const char *module, const char *name,
+					  const void *input, size_t input_len,
+					  vci_rpccall_callback cb, void *ctx)
+{
+	_vci_client_call_async(
+		client->cd, (char*)module, (char*)name, (void*)input, input_len,
+		cb, ctx);
+}
+
+int
+vci_client_call_batch(vci_client *client,
+					  const char *module, const char *name,
+					  const vci_payload *inputs, size_t count,
+					  vci_rpc_result *results)
+{
+	return _vci_client_call_batch(
+		client->cd, (char*)module, (char*)name,
+		(vci_payload*)inputs, count, results);
+}
+
+void
+vci_rpc_results_free(vci_rpc_result *results, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		free(results[i].output);
+		results[i].output = NULL;
+		results[i].output_len = 0;
+		vci_error_free(&results[i].err);
+		vci_error_init(&results[i].err);
+	}
+}
+
 void
 vci_rpccall_free(vci_rpccall *call)
 {
@@ -247,6 +569,15 @@ vci_rpccall_store_output_into(vci_rpccall *call,
 	return _vci_rpccall_store_output_into(call->rd, output, err);
 }
 
+int
+vci_rpccall_store_output_into_v2(vci_rpccall *call,
+								 void **output, size_t *output_len,
+								 vci_error *err)
+{
+	return _vci_rpccall_store_output_into_v2(
+		call->rd, output, output_len, err);
+}
+
 vci_subscription *
 vci_client_subscribe(
 	vci_client *client, const char *module, const char *name,
@@ -262,6 +593,36 @@ vci_client_subscribe(
 	return out;
 }
 
+vci_subscription *
+vci_client_subscribe_v2(
+	vci_client *client, const char *module, const char *name,
+	const vci_subscriber_object_v2* subscriber)
+{
+	vci_subscription *out = malloc(sizeof(vci_subscription));
+	if (out == NULL) {
+		return NULL;
+	}
+	out->sd = _vci_client_subscribe_v2(
+		client->cd, (char*)module, (char*)name,
+		(vci_subscriber_object_v2 *)subscriber);
+	return out;
+}
+
+vci_subscription *
+vci_client_subscribe_batch(
+	vci_client *client, const char *module, const char *name,
+	const vci_batch_subscriber_object* subscriber)
+{
+	vci_subscription *out = malloc(sizeof(vci_subscription));
+	if (out == NULL) {
+		return NULL;
+	}
+	out->sd = _vci_client_subscribe_batch(
+		client->cd, (char*)module, (char*)name,
+		(vci_batch_subscriber_object *)subscriber);
+	return out;
+}
+
 void
 vci_subscription_free(vci_subscription *sub)
 {
@@ -287,6 +648,12 @@ vci_subscription_coalesce(vci_subscription *sub)
 	_vci_subscription_coalesce(sub->sd);
 }
 
+int
+vci_subscription_coalesce_by_key(vci_subscription *sub, const char *path)
+{
+	return _vci_subscription_coalesce_by_key(sub->sd, (char *)path);
+}
+
 void
 vci_subscription_drop_after_limit(vci_subscription *sub, uint32_t limit)
 {
@@ -296,7 +663,14 @@ vci_subscription_drop_after_limit(vci_subscription *sub, uint32_t limit)
 void
 vci_subscription_block_after_limit(vci_subscription *sub, uint32_t limit)
 {
-	_vci_subscription_drop_after_limit(sub->sd, limit);
+	_vci_subscription_block_after_limit(sub->sd, limit);
+}
+
+void
+vci_subscription_block_with_watermarks(vci_subscription *sub,
+									   uint32_t high, uint32_t low)
+{
+	_vci_subscription_block_with_watermarks(sub->sd, high, low);
 }
 
 void
@@ -304,3 +678,58 @@ vci_subscription_remove_limit(vci_subscription *sub)
 {
 	_vci_subscription_remove_limit(sub->sd);
 }
+
+int
+vci_subscription_set_encoding(vci_subscription *sub, vci_encoding enc)
+{
+	return _vci_subscription_set_encoding(sub->sd, enc);
+}
+
+int
+vci_subscription_fd(vci_subscription *sub)
+{
+	int fd = _vci_subscription_fd(sub->sd);
+	if (fd < 0) {
+		errno = -fd;
+		return -1;
+	}
+	return fd;
+}
+
+int
+vci_subscription_dispatch(vci_subscription *sub, size_t max)
+{
+	return _vci_subscription_dispatch(sub->sd, max);
+}
+
+int
+vci_subscription_set_executor(vci_subscription *sub, vci_executor *exec,
+							  size_t ring_size)
+{
+	return _vci_subscription_set_executor(sub->sd, exec->ed, ring_size);
+}
+
+void
+vci_subscription_stats(vci_subscription *sub,
+					   vci_subscription_statistics *stats)
+{
+	_vci_subscription_stats(sub->sd, stats);
+}
+
+int
+vci_stats_snapshot(vci_rpc_stats **stats, size_t *count)
+{
+	return _vci_stats_snapshot(stats, count);
+}
+
+void
+vci_stats_free(vci_rpc_stats *stats, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		free(stats[i].component);
+		free(stats[i].model);
+		free(stats[i].module);
+		free(stats[i].name);
+	}
+	free(stats);
+}
@@ -3,8 +3,14 @@
 //
 // SPDX-License-Identifier: LGPL-2.1-only
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <exception>
 #include <functional>
+#include <new>
+#include <stdexcept>
+#include <system_error>
 
 #include "vci.hpp"
 #include "vci.h"
@@ -27,38 +33,125 @@ _vci_cpp_exception_to_error(const vci::Exception &e, vci_error *error)
 	error->path = strdup(e.path().c_str());
 }
 
+// Handlers may throw more than vci::Exception, and the Buffer they write
+// to throws std::bad_alloc, but nothing may unwind into the library.
+// Called from a catch block, it reports whatever was thrown as an error.
+static void
+_vci_cpp_unexpected_to_error(vci_error *error)
+{
+	try {
+		throw;
+	} catch (const std::exception& e) {
+		_vci_cpp_exception_to_error(vci::Exception("", e.what(), ""), error);
+	} catch (...) {
+		_vci_cpp_exception_to_error(
+			vci::Exception("", "vci: handler threw an unknown exception", ""),
+			error);
+	}
+}
+
 int
-_vci_cpp_call_config_set(void *obj, const char *in, vci_error *error)
+_vci_cpp_call_config_set(void *obj, const void *in, size_t in_len,
+						 vci_error *error)
 {
 	auto conf = (vci::Config *) obj;
 	try {
-		conf->set(std::string(in));
+		conf->set(vci::EncodedView((const char *) in, in_len));
 	} catch (const vci::Exception& e) {
 		_vci_cpp_exception_to_error(e, error);
 		return -1;
+	} catch (...) {
+		_vci_cpp_unexpected_to_error(error);
+		return -1;
 	}
 	return 0;
 }
 
 int
-_vci_cpp_call_config_check (void *obj, const char *in, vci_error *error)
+_vci_cpp_call_config_set_delta(void *obj, const void *delta, size_t delta_len,
+							   vci_error *error)
+{
+	auto conf = dynamic_cast<vci::DeltaConfig *>((vci::Config *) obj);
+	try {
+		conf->set_delta(vci::EncodedView((const char *) delta, delta_len));
+	} catch (const vci::Exception& e) {
+		_vci_cpp_exception_to_error(e, error);
+		return -1;
+	} catch (...) {
+		_vci_cpp_unexpected_to_error(error);
+		return -1;
+	}
+	return 0;
+}
+
+int
+_vci_cpp_call_config_check_prepare(void *obj, const void *in, size_t in_len,
+								   void **prepared, vci_error *error)
+{
+	auto conf = dynamic_cast<vci::PreparedConfig *>((vci::Config *) obj);
+	try {
+		*prepared = new std::shared_ptr<void>(
+			conf->prepare(vci::EncodedView((const char *) in, in_len)));
+	} catch (const vci::Exception& e) {
+		_vci_cpp_exception_to_error(e, error);
+		return -1;
+	} catch (...) {
+		_vci_cpp_unexpected_to_error(error);
+		return -1;
+	}
+	return 0;
+}
+
+int
+_vci_cpp_call_config_set_prepared(void *obj, void *prepared, vci_error *error)
+{
+	auto conf = dynamic_cast<vci::PreparedConfig *>((vci::Config *) obj);
+	try {
+		conf->set_prepared(*(std::shared_ptr<void> *) prepared);
+	} catch (const vci::Exception& e) {
+		_vci_cpp_exception_to_error(e, error);
+		return -1;
+	} catch (...) {
+		_vci_cpp_unexpected_to_error(error);
+		return -1;
+	}
+	return 0;
+}
+
+void
+_vci_cpp_call_config_prepared_free(void *, void *prepared)
+{
+	delete (std::shared_ptr<void> *) prepared;
+}
+
+int
+_vci_cpp_call_config_check (void *obj, const void *in, size_t in_len,
+							vci_error *error)
 {
 	auto conf = (vci::Config *) obj;
 	try {
-		conf->check(std::string(in));
+		conf->check(vci::EncodedView((const char *) in, in_len));
 	} catch (const vci::Exception& e) {
 		_vci_cpp_exception_to_error(e, error);
 		return -1;
+	} catch (...) {
+		_vci_cpp_unexpected_to_error(error);
+		return -1;
 	}
 	return 0;
 }
 
 void
-_vci_cpp_call_config_get (void *obj, char **out)
+_vci_cpp_call_config_get (void *obj, vci_buf *out)
 {
 	auto conf = (vci::Config *) obj;
-	auto got = conf->get();
-	*out = strdup(got.c_str());
+	vci::Buffer buf(out);
+	try {
+		conf->get(buf);
+	} catch (...) {
+		// get cannot fail, so whatever it wrote is dropped instead.
+		out->len = 0;
+	}
 }
 
 void
@@ -69,11 +162,29 @@ _vci_cpp_call_config_free(void *obj)
 }
 
 void
-_vci_cpp_call_state_get (void *obj, char **out)
+_vci_cpp_call_state_get (void *obj, vci_buf *out)
 {
 	auto state = (vci::State *) obj;
-	auto got = state->get();
-	*out = strdup(got.c_str());
+	vci::Buffer buf(out);
+	try {
+		state->get(buf);
+	} catch (...) {
+		// get cannot fail, so whatever it wrote is dropped instead.
+		out->len = 0;
+	}
+}
+
+void
+_vci_cpp_call_state_stream(void *obj, vci_state_writer *w)
+{
+	auto state = dynamic_cast<vci::StreamingState *>((vci::State *) obj);
+	vci::StateWriter writer(w);
+	try {
+		state->get(writer);
+	} catch (...) {
+		// As for get, the partial document is dropped instead.
+		vci_state_writer_fail(w);
+	}
 }
 
 void
@@ -84,10 +195,10 @@ _vci_cpp_call_state_free(void *obj)
 }
 
 void
-_vci_cpp_call_subscriber (void *obj, const char *in)
+_vci_cpp_call_subscriber (void *obj, const void *in, size_t in_len)
 {
 	auto subscriber = (vci::Subscriber *) obj;
-	subscriber->operator()(std::string(in));
+	subscriber->operator()(vci::EncodedView((const char *) in, in_len));
 }
 
 void
@@ -97,16 +208,44 @@ _vci_cpp_call_subscriber_free(void *obj)
 	delete subscriber;
 }
 
+struct _vci_cpp_batch_subscriber {
+	vci::BatchSubscriberFn fn;
+	std::vector<vci::EncodedInput> batch;
+};
+
+void
+_vci_cpp_call_batch_subscriber(void *obj, const vci_payload *in, size_t count)
+{
+	auto subscriber = (_vci_cpp_batch_subscriber *) obj;
+	// The strings are kept from batch to batch to reuse their storage.
+	subscriber->batch.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		subscriber->batch[i].assign((const char *) in[i].data, in[i].len);
+	}
+	subscriber->fn(subscriber->batch);
+}
+
+void
+_vci_cpp_call_batch_subscriber_free(void *obj)
+{
+	auto subscriber = (_vci_cpp_batch_subscriber *) obj;
+	delete subscriber;
+}
+
 int
-_vci_cpp_call_rpc(void *obj, const char *in, char **out, vci_error *error)
+_vci_cpp_call_rpc(void *obj, const void *in, size_t in_len,
+				  vci_buf *out, vci_error *error)
 {
 	auto method = (vci::Method *) obj;
+	vci::Buffer buf(out);
 	try {
-		auto got = method->operator()(std::string(in));
-		*out = strdup(got.c_str());
+		method->operator()(vci::EncodedView((const char *) in, in_len), buf);
 	} catch (const vci::Exception &e) {
 		_vci_cpp_exception_to_error(e, error);
 		return -1;
+	} catch (...) {
+		_vci_cpp_unexpected_to_error(error);
+		return -1;
 	}
 	return 0;
 }
@@ -119,15 +258,22 @@ _vci_cpp_call_rpc_free(void *obj)
 }
 
 int
-_vci_cpp_call_rpc_meta(void *obj, const char *meta, const char *in, char **out, vci_error *error)
+_vci_cpp_call_rpc_meta(void *obj, const void *meta, size_t meta_len,
+					   const void *in, size_t in_len,
+					   vci_buf *out, vci_error *error)
 {
 	auto method = (vci::MethodMeta *) obj;
+	vci::Buffer buf(out);
 	try {
-		auto got = method->operator()(std::string(meta), std::string(in));
-		*out = strdup(got.c_str());
+		method->operator()(
+			vci::EncodedView((const char *) meta, meta_len),
+			vci::EncodedView((const char *) in, in_len), buf);
 	} catch (const vci::Exception &e) {
 		_vci_cpp_exception_to_error(e, error);
 		return -1;
+	} catch (...) {
+		_vci_cpp_unexpected_to_error(error);
+		return -1;
 	}
 	return 0;
 }
@@ -141,6 +287,7 @@ _vci_cpp_call_rpc_meta_free(void *obj)
 
 struct _vci::_CompImpl {
 	vci_component* comp;
+	std::shared_ptr<vci::Executor> executor;
 	~_CompImpl() {
 		vci_component_free(comp);
 	}
@@ -148,6 +295,8 @@ struct _vci::_CompImpl {
 
 struct _vci::_ClientImpl {
 	vci_client* client;
+	std::shared_ptr<vci::Executor> executor;
+	size_t ring_size = 0;
 	_ClientImpl() {};
 	_ClientImpl(vci_client *client) {
 		this->client=client;
@@ -185,6 +334,154 @@ vci::Exception::path() const
 	return this->_path;
 }
 
+void
+vci::Buffer::reserve(size_t len)
+{
+	if (vci_buf_reserve(this->_buf, len) != 0) {
+		throw std::bad_alloc();
+	}
+}
+
+void
+vci::Buffer::append(const char *data, size_t len)
+{
+	if (vci_buf_append(this->_buf, data, len) != 0) {
+		throw std::bad_alloc();
+	}
+}
+
+void
+vci::Buffer::append(const std::string& data)
+{
+	this->append(data.data(), data.size());
+}
+
+size_t
+vci::Buffer::size() const
+{
+	return this->_buf->len;
+}
+
+void
+vci::StateWriter::reserve(size_t len)
+{
+	if (this->_buf != NULL) {
+		this->_buf->reserve(len);
+		return;
+	}
+	if (vci_state_writer_reserve(this->_w, len) != 0) {
+		if (errno == EOVERFLOW) {
+			throw std::length_error("vci: state document too large");
+		}
+		throw std::logic_error("vci: state writer used after get returned");
+	}
+}
+
+void
+vci::StateWriter::write(const char *data, size_t len)
+{
+	if (this->_buf != NULL) {
+		this->_buf->append(data, len);
+		return;
+	}
+	if (vci_state_writer_write(this->_w, data, len) != 0) {
+		throw std::logic_error("vci: state writer used after get returned");
+	}
+}
+
+void
+vci::StateWriter::write(const std::string& data)
+{
+	this->write(data.data(), data.size());
+}
+
+// Run a Buffer writing handler into a scratch buffer for callers of the
+// returning form.
+static std::string
+_vci_cpp_collect(const std::function<void(vci::Buffer&)>& fn)
+{
+	vci_buf scratch;
+	vci_buf_init(&scratch);
+	vci::Buffer buf(&scratch);
+	try {
+		fn(buf);
+	} catch (...) {
+		vci_buf_free(&scratch);
+		throw;
+	}
+	std::string out(scratch.data != NULL ? scratch.data : "", scratch.len);
+	vci_buf_free(&scratch);
+	return out;
+}
+
+vci::EncodedOutput
+vci::BufferState::get()
+{
+	return _vci_cpp_collect([this](vci::Buffer& out) {
+		this->get(out);
+	});
+}
+
+vci::EncodedOutput
+vci::BufferMethod::operator()(const vci::EncodedInput& input)
+{
+	return _vci_cpp_collect([this, &input](vci::Buffer& out) {
+		this->operator()(input, out);
+	});
+}
+
+vci::EncodedOutput
+vci::BufferMethodMeta::operator()(const vci::EncodedInput& meta,
+								  const vci::EncodedInput& input)
+{
+	return _vci_cpp_collect([this, &meta, &input](vci::Buffer& out) {
+		this->operator()(meta, input, out);
+	});
+}
+
+vci::RPCResult::RPCResult(const vci::EncodedOutput& output)
+	: _output(output)
+{
+}
+
+vci::RPCResult::RPCResult(const vci::Exception& error)
+	: _error(std::make_shared<vci::Exception>(error))
+{
+}
+
+bool
+vci::RPCResult::ok() const
+{
+	return this->_error == nullptr;
+}
+
+const vci::EncodedOutput&
+vci::RPCResult::output() const
+{
+	if (this->_error != nullptr) {
+		throw *this->_error;
+	}
+	return this->_output;
+}
+
+const vci::Exception*
+vci::RPCResult::error() const
+{
+	return this->_error.get();
+}
+
+void
+vci::CachedConfig::invalidate()
+{
+	__atomic_add_fetch(&this->_generation, 1, __ATOMIC_RELEASE);
+}
+
+void
+vci::CachedState::invalidate()
+{
+	__atomic_add_fetch(&this->_generation, 1, __ATOMIC_RELEASE);
+}
+
 vci::Model::Model(std::string name)
 {
 	this->_name = name;
@@ -204,6 +501,39 @@ vci::Model::state(vci::State* state)
 	return *this;
 }
 
+vci::Model&
+vci::Model::stats()
+{
+	this->_stats = true;
+	return *this;
+}
+
+static_assert((int) vci::Encoding::JSON == VCI_ENCODING_JSON &&
+			  (int) vci::Encoding::CBOR == VCI_ENCODING_CBOR,
+			  "vci::Encoding must match vci_encoding");
+
+vci::Model&
+vci::Model::encoding(vci::Encoding enc)
+{
+	this->_encoding = enc;
+	return *this;
+}
+
+vci::Model&
+vci::Model::admission(uint32_t max_in_flight, uint32_t max_queued)
+{
+	return this->admission("", "", max_in_flight, max_queued);
+}
+
+vci::Model&
+vci::Model::admission(const std::string& module, const std::string& name,
+					  uint32_t max_in_flight, uint32_t max_queued)
+{
+	this->_admission[std::make_pair(module, name)] =
+		std::make_pair(max_in_flight, max_queued);
+	return *this;
+}
+
 class methodFunc : public vci::Method {
 public:
 	methodFunc (vci::MethodFn fn) : _fn(fn) {}
@@ -259,6 +589,28 @@ vci::Model::rpc(const std::string& module,
 	return *this;
 }
 
+vci::Executor::Executor(const std::string& name, size_t threads)
+{
+	this->_exec = vci_executor_new(name.c_str(), threads);
+}
+
+vci::Executor::~Executor()
+{
+	vci_executor_free(this->_exec);
+}
+
+void
+vci::Executor::run()
+{
+	vci_executor_run(this->_exec);
+}
+
+void
+vci::Executor::stop()
+{
+	vci_executor_stop(this->_exec);
+}
+
 vci::Component::Component(std::string name)
 {
 	this->_impl = new _vci::_CompImpl();
@@ -274,46 +626,78 @@ vci::Component&
 vci::Component::model(Model &model)
 {
 	auto mod = vci_component_model(this->_impl->comp, model._name.c_str());
+	vci_model_set_encoding(mod, (vci_encoding) model._encoding);
+	for (const auto &limit : model._admission) {
+		if (limit.first.first.empty() && limit.first.second.empty()) {
+			vci_model_set_admission(mod,
+				limit.second.first, limit.second.second);
+		} else {
+			vci_model_set_rpc_admission(mod,
+				limit.first.first.c_str(), limit.first.second.c_str(),
+				limit.second.first, limit.second.second);
+		}
+	}
 	if (model._config != NULL){
-		vci_config_object config = {
-			model._config,
-			_vci_cpp_call_config_set,
-			_vci_cpp_call_config_check,
-			_vci_cpp_call_config_get,
-			_vci_cpp_call_config_free,
-		};
-		vci_model_config(mod, &config);
+		vci_config_object_v2 config = {};
+		config.obj = model._config;
+		config.set = _vci_cpp_call_config_set;
+		config.check = _vci_cpp_call_config_check;
+		config.get = _vci_cpp_call_config_get;
+		config.free = _vci_cpp_call_config_free;
+		auto cached = dynamic_cast<vci::CachedConfig*>(model._config);
+		if (cached != NULL) {
+			config.generation = &cached->_generation;
+		}
+		if (dynamic_cast<vci::DeltaConfig*>(model._config) != NULL) {
+			config.set_delta = _vci_cpp_call_config_set_delta;
+		}
+		if (dynamic_cast<vci::PreparedConfig*>(model._config) != NULL) {
+			config.check_prepare = _vci_cpp_call_config_check_prepare;
+			config.set_prepared = _vci_cpp_call_config_set_prepared;
+			config.prepared_free = _vci_cpp_call_config_prepared_free;
+		}
+		vci_model_config_v2(mod, &config);
 	}
 
 	if (model._state != NULL) {
-		vci_state_object state = {
-			model._state,
-			_vci_cpp_call_state_get,
-			_vci_cpp_call_state_free,
-		};
-		vci_model_state(mod, &state);
+		vci_state_object_v2 state = {};
+		state.obj = model._state;
+		state.get = _vci_cpp_call_state_get;
+		state.free = _vci_cpp_call_state_free;
+		auto cached = dynamic_cast<vci::CachedState*>(model._state);
+		if (cached != NULL) {
+			state.generation = &cached->_generation;
+		}
+		if (dynamic_cast<vci::StreamingState*>(model._state) != NULL) {
+			state.stream = _vci_cpp_call_state_stream;
+		}
+		vci_model_state_v2(mod, &state);
+	}
+
+	if (model._stats) {
+		vci_model_stats(mod);
 	}
 
 	for (const auto &module_rpc : model._methods) {
 		for (const auto &name_method : module_rpc.second) {
-			vci_rpc_object rpc = {
+			vci_rpc_object_v2 rpc = {
 				name_method.second,
 				_vci_cpp_call_rpc,
 				_vci_cpp_call_rpc_free,
 			};
-			vci_model_rpc(mod, module_rpc.first.c_str(),
-						  name_method.first.c_str(), &rpc);
+			vci_model_rpc_v2(mod, module_rpc.first.c_str(),
+							 name_method.first.c_str(), &rpc);
 		}
 	}
 	for (const auto &module_rpc : model._meta_methods) {
 		for (const auto &name_method : module_rpc.second) {
-			vci_rpc_meta_object rpc = {
+			vci_rpc_meta_object_v2 rpc = {
 				name_method.second,
 				_vci_cpp_call_rpc_meta,
 				_vci_cpp_call_rpc_meta_free,
 			};
-			vci_model_rpc_meta(mod, module_rpc.first.c_str(),
-						  name_method.first.c_str(), &rpc);
+			vci_model_rpc_meta_v2(mod, module_rpc.first.c_str(),
+								  name_method.first.c_str(), &rpc);
 		}
 	}
 	free(mod);
@@ -370,12 +754,12 @@ vci::Component::subscribe(
 {
 	vci_error err;
 	vci_error_init(&err);
-	vci_subscriber_object _csub = {
+	vci_subscriber_object_v2 _csub = {
 		subscriber,
 		_vci_cpp_call_subscriber,
 		_vci_cpp_call_subscriber_free,
 	};
-	int ret = vci_component_subscribe(
+	int ret = vci_component_subscribe_v2(
 		this->_impl->comp, module.c_str(), notification.c_str(), &_csub, &err);
 	if (ret != 0) {
 		_vci_cpp_error_to_exception(&err);
@@ -393,6 +777,15 @@ vci::Component::subscribe(
 	return *this;
 }
 
+vci::Component&
+vci::Component::executor(std::shared_ptr<vci::Executor> exec, size_t ring_size)
+{
+	vci_component_set_executor(
+		this->_impl->comp, exec ? exec->_exec : nullptr, ring_size);
+	this->_impl->executor = exec;
+	return *this;
+}
+
 vci::Component&
 vci::Component::unsubscribe(
 	const std::string& module, const std::string& notification)
@@ -455,8 +848,9 @@ std::shared_ptr<vci::RPCCall>
 vci::Client::call(const std::string& module,
 				  const std::string& name, const std::string& input)
 {
-	auto ccall = vci_client_call(
-		this->_impl->client, module.c_str(), name.c_str(), input.c_str());
+	auto ccall = vci_client_call_v2(
+		this->_impl->client, module.c_str(), name.c_str(),
+		input.data(), input.size());
 	auto impl = new _vci::_RPCCallImpl();
 	impl->call = ccall;
 	auto out = std::make_shared<vci::RPCCall>();
@@ -464,6 +858,188 @@ vci::Client::call(const std::string& module,
 	return out;
 }
 
+std::shared_ptr<vci::RPCCall>
+vci::Client::call(const std::string& module,
+				  const std::string& name, const std::string& input,
+				  vci::Encoding enc)
+{
+	auto ccall = vci_client_call_encoded(
+		this->_impl->client, module.c_str(), name.c_str(),
+		(vci_encoding) enc, input.data(), input.size());
+	auto impl = new _vci::_RPCCallImpl();
+	impl->call = ccall;
+	auto out = std::make_shared<vci::RPCCall>();
+	out->_impl = impl;
+	return out;
+}
+
+// The inputs of call_with are written into buffers pooled per thread, so
+// that they are allocated once and reused from call to call. Only a few
+// are kept, more are only needed while calls nest.
+struct _vci_cpp_call_inputs {
+	static const size_t max_idle = 4;
+	std::vector<vci_buf *> idle;
+	_vci_cpp_call_inputs() {
+		// Returning a buffer must not allocate.
+		idle.reserve(max_idle);
+	}
+	~_vci_cpp_call_inputs() {
+		for (auto buf : idle) {
+			vci_buf_free(buf);
+			delete buf;
+		}
+	}
+};
+
+static thread_local _vci_cpp_call_inputs _vci_cpp_call_inputs_pool;
+
+static vci_buf *
+_vci_cpp_call_input_get()
+{
+	auto& idle = _vci_cpp_call_inputs_pool.idle;
+	if (idle.empty()) {
+		auto buf = new vci_buf;
+		vci_buf_init(buf);
+		return buf;
+	}
+	auto buf = idle.back();
+	idle.pop_back();
+	return buf;
+}
+
+static void
+_vci_cpp_call_input_put(vci_buf *buf)
+{
+	auto& idle = _vci_cpp_call_inputs_pool.idle;
+	if (idle.size() >= _vci_cpp_call_inputs::max_idle) {
+		vci_buf_free(buf);
+		delete buf;
+		return;
+	}
+	buf->len = 0;
+	idle.push_back(buf);
+}
+
+vci::Client::_Input::_Input() : buffer(_vci_cpp_call_input_get())
+{
+}
+
+vci::Client::_Input::~_Input()
+{
+	_vci_cpp_call_input_put(this->buffer._buf);
+}
+
+vci::Client::_Reply::~_Reply()
+{
+	free(this->_data);
+}
+
+vci::Client::_Reply
+vci::Client::_call_buffered(const std::string& module,
+							const std::string& name, vci::Buffer& input)
+{
+	auto ccall = vci_client_call_v2(
+		this->_impl->client, module.c_str(), name.c_str(),
+		input._buf->data, input._buf->len);
+
+	void *out;
+	size_t out_len;
+	vci_error err;
+	vci_error_init(&err);
+	auto rc = vci_rpccall_store_output_into_v2(ccall, &out, &out_len, &err);
+	vci_rpccall_free(ccall);
+	if (rc != 0) {
+		_vci_cpp_error_to_exception(&err);
+	}
+	return _Reply(out, out_len);
+}
+
+struct _vci_cpp_async_call {
+	vci::RPCResultFn on_result;
+	vci::RPCErrorFn on_error;
+};
+
+void
+_vci_cpp_call_async_done(void *ctx, int rc,
+						 const void *out, size_t out_len, vci_error *error)
+{
+	std::unique_ptr<_vci_cpp_async_call> call((_vci_cpp_async_call *) ctx);
+	try {
+		if (rc != 0) {
+			call->on_error(vci::Exception(
+				error->app_tag != NULL ? error->app_tag : "",
+				error->info != NULL ? error->info : "",
+				error->path != NULL ? error->path : ""));
+		} else {
+			call->on_result(vci::EncodedOutput((const char *) out, out_len));
+		}
+	} catch (...) {
+		// There is no caller left to see it, the callback's failure is
+		// its own to handle.
+	}
+}
+
+void
+vci::Client::call_async(const std::string& module,
+						const std::string& name,
+						const std::string& input,
+						vci::RPCResultFn on_result,
+						vci::RPCErrorFn on_error)
+{
+	auto ctx = new _vci_cpp_async_call{on_result, on_error};
+	vci_client_call_async(
+		this->_impl->client, module.c_str(), name.c_str(),
+		input.data(), input.size(), _vci_cpp_call_async_done, ctx);
+}
+
+std::future<vci::EncodedOutput>
+vci::Client::call_async(const std::string& module,
+						const std::string& name,
+						const std::string& input)
+{
+	auto result = std::make_shared<std::promise<vci::EncodedOutput>>();
+	this->call_async(module, name, input,
+		[result](const vci::EncodedOutput& output) {
+			result->set_value(output);
+		},
+		[result](const vci::Exception& error) {
+			result->set_exception(std::make_exception_ptr(error));
+		});
+	return result->get_future();
+}
+
+std::vector<vci::RPCResult>
+vci::Client::call_batch(const std::string& module,
+						const std::string& name,
+						const std::vector<vci::EncodedInput>& inputs)
+{
+	std::vector<vci_payload> cinputs(inputs.size());
+	for (size_t i = 0; i < inputs.size(); i++) {
+		cinputs[i].data = inputs[i].data();
+		cinputs[i].len = inputs[i].size();
+	}
+	std::vector<vci_rpc_result> cresults(inputs.size());
+	vci_client_call_batch(
+		this->_impl->client, module.c_str(), name.c_str(),
+		cinputs.data(), cinputs.size(), cresults.data());
+
+	std::vector<vci::RPCResult> out;
+	out.reserve(cresults.size());
+	for (auto &res : cresults) {
+		if (res.rc != 0) {
+			out.emplace_back(vci::Exception(
+				res.err.app_tag != NULL ? res.err.app_tag : "",
+				res.err.info != NULL ? res.err.info : "",
+				res.err.path != NULL ? res.err.path : ""));
+		} else {
+			out.emplace_back(vci::EncodedOutput(
+				(const char *) res.output, res.output_len));
+		}
+	}
+	vci_rpc_results_free(cresults.data(), cresults.size());
+	return out;
+}
+
 void
 vci::Client::emit(
 	const std::string& module,
@@ -472,9 +1048,26 @@ vci::Client::emit(
 {
 	vci_error err;
 	vci_error_init(&err);
-	auto rc = vci_client_emit(
-		this->_impl->client, module.c_str(), name.c_str(), data.c_str(),
-		&err);
+	auto rc = vci_client_emit_v2(
+		this->_impl->client, module.c_str(), name.c_str(),
+		data.data(), data.size(), &err);
+	if (rc != 0) {
+		_vci_cpp_error_to_exception(&err);
+	}
+}
+
+void
+vci::Client::emit(
+	const std::string& module,
+	const std::string& name,
+	const vci::EncodedInput& data,
+	vci::Encoding enc)
+{
+	vci_error err;
+	vci_error_init(&err);
+	auto rc = vci_client_emit_encoded(
+		this->_impl->client, module.c_str(), name.c_str(),
+		(vci_encoding) enc, data.data(), data.size(), &err);
 	if (rc != 0) {
 		_vci_cpp_error_to_exception(&err);
 	}
@@ -484,53 +1077,127 @@ vci::EncodedOutput
 vci::Client::config_by_model(const std::string& model) {
 	vci_error err;
 	vci_error_init(&err);
-	char *out;
-	auto rc = vci_client_store_config_by_model_into(
-		this->_impl->client, model.c_str(), &out, &err);
+	void *out;
+	size_t out_len;
+	auto rc = vci_client_store_config_by_model_into_v2(
+		this->_impl->client, model.c_str(), &out, &out_len, &err);
 	if (rc != 0) {
 		_vci_cpp_error_to_exception(&err);
 	}
-	return vci::EncodedOutput(out);
+	vci::EncodedOutput output((const char *) out, out_len);
+	free(out);
+	return output;
 }
 
 vci::EncodedOutput
 vci::Client::state_by_model(const std::string& model) {
 	vci_error err;
 	vci_error_init(&err);
-	char *out;
-	auto rc = vci_client_store_state_by_model_into(
-		this->_impl->client, model.c_str(), &out, &err);
+	void *out;
+	size_t out_len;
+	auto rc = vci_client_store_state_by_model_into_v2(
+		this->_impl->client, model.c_str(), &out, &out_len, &err);
+	if (rc != 0) {
+		_vci_cpp_error_to_exception(&err);
+	}
+	vci::EncodedOutput output((const char *) out, out_len);
+	free(out);
+	return output;
+}
+
+struct _vci_cpp_chunk_read {
+	vci::ChunkReaderFn& reader;
+	std::exception_ptr error;
+};
+
+int
+_vci_cpp_call_chunk_reader(void *ctx, const void *data, size_t len)
+{
+	auto read = (_vci_cpp_chunk_read *) ctx;
+	try {
+		read->reader((const char *) data, len);
+	} catch (...) {
+		read->error = std::current_exception();
+		return 1;
+	}
+	return 0;
+}
+
+void
+vci::Client::read_config_by_model(const std::string& model,
+								  vci::ChunkReaderFn reader,
+								  size_t chunk_size)
+{
+	vci_error err;
+	vci_error_init(&err);
+	_vci_cpp_chunk_read read{reader, nullptr};
+	auto rc = vci_client_read_config_by_model(
+		this->_impl->client, model.c_str(), chunk_size,
+		_vci_cpp_call_chunk_reader, &read, &err);
+	if (read.error) {
+		std::rethrow_exception(read.error);
+	}
+	if (rc != 0) {
+		_vci_cpp_error_to_exception(&err);
+	}
+}
+
+void
+vci::Client::read_state_by_model(const std::string& model,
+								 vci::ChunkReaderFn reader,
+								 size_t chunk_size)
+{
+	vci_error err;
+	vci_error_init(&err);
+	_vci_cpp_chunk_read read{reader, nullptr};
+	auto rc = vci_client_read_state_by_model(
+		this->_impl->client, model.c_str(), chunk_size,
+		_vci_cpp_call_chunk_reader, &read, &err);
+	if (read.error) {
+		std::rethrow_exception(read.error);
+	}
 	if (rc != 0) {
 		_vci_cpp_error_to_exception(&err);
 	}
-	return vci::EncodedOutput(out);
 }
 
 struct _vci::_SubscriptionImpl {
 	vci_subscription* sub;
+	std::shared_ptr<vci::Executor> executor;
 	~_SubscriptionImpl() {
 		vci_subscription_free(sub);
 	}
 };
 
+std::shared_ptr<vci::Subscription>
+vci::Client::_subscription(vci_subscription *csub)
+{
+	auto impl = new _vci::_SubscriptionImpl();
+	impl->sub = csub;
+	if (this->_impl->executor) {
+		vci_subscription_set_executor(
+			csub, this->_impl->executor->_exec, this->_impl->ring_size);
+		impl->executor = this->_impl->executor;
+	}
+	auto out = std::make_shared<vci::Subscription>();
+	out->_impl = impl;
+	return out;
+}
+
 std::shared_ptr<vci::Subscription>
 vci::Client::subscribe(
 	const std::string& module,
 	const std::string& name,
 	vci::Subscriber* subscriber)
 {
-	vci_subscriber_object _csub = {
+	vci_subscriber_object_v2 _csub = {
 		subscriber,
 		_vci_cpp_call_subscriber,
 		_vci_cpp_call_subscriber_free,
 	};
-	auto csub = vci_client_subscribe(
+	auto csub = vci_client_subscribe_v2(
 		this->_impl->client, module.c_str(), name.c_str(), &_csub);
-	auto impl = new _vci::_SubscriptionImpl();
-	impl->sub = csub;
-	auto out = std::make_shared<vci::Subscription>();
-	out->_impl = impl;
-	return out;
+	return this->_subscription(csub);
 }
 
 std::shared_ptr<vci::Subscription>
@@ -542,6 +1209,33 @@ vci::Client::subscribe(
 	return this->subscribe(module, name, new subscriberFunc(subscriber));
 }
 
+std::shared_ptr<vci::Subscription>
+vci::Client::subscribe_batch(
+	const std::string& module,
+	const std::string& name,
+	vci::BatchSubscriberFn subscriber,
+	size_t max_batch,
+	std::chrono::microseconds max_delay)
+{
+	vci_batch_subscriber_object _csub = {
+		new _vci_cpp_batch_subscriber{subscriber, {}},
+		_vci_cpp_call_batch_subscriber,
+		_vci_cpp_call_batch_subscriber_free,
+		max_batch,
+		(uint32_t) max_delay.count(),
+	};
+	auto csub = vci_client_subscribe_batch(
+		this->_impl->client, module.c_str(), name.c_str(), &_csub);
+	return this->_subscription(csub);
+}
+
+void
+vci::Client::executor(std::shared_ptr<vci::Executor> exec, size_t ring_size)
+{
+	this->_impl->executor = exec;
+	this->_impl->ring_size = ring_size;
+}
+
 vci::Subscription::Subscription() {}
 vci::Subscription::~Subscription() {
 	delete this->_impl;
@@ -575,6 +1269,14 @@ vci::Subscription::coalesce()
 	vci_subscription_coalesce(this->_impl->sub);
 }
 
+void
+vci::Subscription::coalesce_by_key(const std::string& path)
+{
+	if (vci_subscription_coalesce_by_key(this->_impl->sub, path.c_str()) != 0) {
+		throw std::invalid_argument("invalid JSON pointer: " + path);
+	}
+}
+
 void
 vci::Subscription::drop_after_limit(uint32_t limit)
 {
@@ -587,12 +1289,53 @@ vci::Subscription::block_after_limit(uint32_t limit)
 	vci_subscription_block_after_limit(this->_impl->sub, limit);
 }
 
+void
+vci::Subscription::block_with_watermarks(uint32_t high, uint32_t low)
+{
+	vci_subscription_block_with_watermarks(this->_impl->sub, high, low);
+}
+
 void
 vci::Subscription::remove_limit()
 {
 	vci_subscription_remove_limit(this->_impl->sub);
 }
 
+void
+vci::Subscription::encoding(vci::Encoding enc)
+{
+	vci_subscription_set_encoding(this->_impl->sub, (vci_encoding) enc);
+}
+
+int
+vci::Subscription::fd()
+{
+	auto fd = vci_subscription_fd(this->_impl->sub);
+	if (fd < 0) {
+		throw std::system_error(errno, std::generic_category(),
+								"vci_subscription_fd");
+	}
+	return fd;
+}
+
+size_t
+vci::Subscription::dispatch(size_t max)
+{
+	return vci_subscription_dispatch(this->_impl->sub, max);
+}
+
+vci::SubscriptionStats
+vci::Subscription::stats()
+{
+	vci_subscription_statistics st;
+	vci_subscription_stats(this->_impl->sub, &st);
+	return vci::SubscriptionStats{
+		st.depth, st.high_water, st.delivered, st.dropped,
+		st.coalesced, st.blocked, st.blocked_ns,
+		st.callback_p50_ns, st.callback_p99_ns, st.callback_p999_ns,
+	};
+}
+
 vci::RPCCall::RPCCall() {}
 vci::RPCCall::~RPCCall() {
 	delete this->_impl;
@@ -600,14 +1343,39 @@ vci::RPCCall::~RPCCall() {
 
 std::string vci::RPCCall::output()
 {
-	char *out;
+	void *out;
+	size_t out_len;
 	vci_error err;
 	vci_error_init(&err);
-	auto rc = vci_rpccall_store_output_into(this->_impl->call, &out, &err);
+	auto rc = vci_rpccall_store_output_into_v2(
+		this->_impl->call, &out, &out_len, &err);
 	if (rc != 0) {
 		_vci_cpp_error_to_exception(&err);
 	}
-	std::string output = out;
+	std::string output((const char *) out, out_len);
 	free(out);
 	return output;
 }
+
+std::vector<vci::RPCStats>
+vci::stats_snapshot()
+{
+	vci_rpc_stats *stats;
+	size_t count;
+	if (vci_stats_snapshot(&stats, &count) != 0) {
+		throw std::bad_alloc();
+	}
+	std::vector<vci::RPCStats> out;
+	out.reserve(count);
+	for (size_t i = 0; i < count; i++) {
+		const vci_rpc_stats &st = stats[i];
+		out.push_back(vci::RPCStats{
+			st.component, st.model, st.module, st.name,
+			st.client != 0,
+			st.calls, st.errors, st.bytes_in, st.bytes_out,
+			st.latency_p50_ns, st.latency_p99_ns, st.latency_p999_ns,
+		});
+	}
+	vci_stats_free(stats, count);
+	return out;
+}
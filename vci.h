@@ -5,6 +5,7 @@
 
 #ifndef __VCI_H__
 #define __VCI_H__
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -16,6 +17,8 @@ typedef struct vci_model vci_model;
 typedef struct vci_client vci_client;
 typedef struct vci_rpccall vci_rpccall;
 typedef struct vci_subscription vci_subscription;
+typedef struct vci_state_writer vci_state_writer;
+typedef struct vci_executor vci_executor;
 
 typedef struct {
 	char *app_tag;
@@ -27,6 +30,23 @@ void vci_error_init(vci_error *error);
 char *vci_error_string(vci_error *error);
 void vci_error_free(vci_error *error);
 
+/*
+ * Growable output buffer. Handlers may either use vci_buf_append or
+ * reserve space and write directly at data + len, advancing len. Buffers
+ * handed to handlers are owned and recycled by the library and must not
+ * be referenced once the callback returns.
+ */
+typedef struct vci_buf {
+	char *data;
+	size_t len;
+	size_t cap;
+} vci_buf;
+
+void vci_buf_init(vci_buf *buf);
+int vci_buf_reserve(vci_buf *buf, size_t len);
+int vci_buf_append(vci_buf *buf, const void *data, size_t len);
+void vci_buf_free(vci_buf *buf);
+
 typedef struct {
 	void *obj;
 	int (*set)(void *obj, const char *in, vci_error *error);
@@ -59,6 +79,162 @@ typedef struct {
 	void (*free)(void *obj);
 } vci_subscriber_object;
 
+typedef struct {
+	const void *data;
+	size_t len;
+} vci_payload;
+
+/*
+ * Payloads cross the bus as RFC 7951 JSON. Models, calls and
+ * subscriptions may instead exchange them with the library as CBOR
+ * (RFC 8949) carrying the same data model: objects are maps with text
+ * keys, integers are CBOR integers and other numbers floats. CBOR byte
+ * strings are accepted and read as base64 encoded binary leaves. Tags,
+ * and simple values other than true, false and null, are rejected.
+ */
+typedef enum {
+	VCI_ENCODING_JSON = 0,
+	VCI_ENCODING_CBOR = 1,
+} vci_encoding;
+
+/*
+ * The _v2 objects carry every payload as a (pointer, length) pair rather
+ * than a NUL terminated string. Input buffers belong to the library, are
+ * only valid for the duration of the callback and are not NUL terminated.
+ * Output is written into a library owned vci_buf.
+ * Outputs returned by the _v2 client calls are allocated by the library,
+ * NUL terminated for convenience and must be freed by the caller; the
+ * returned length does not include the terminator.
+ *
+ * Config and state objects may opt in to caching by pointing generation
+ * at a counter the object increments, atomically, whenever the document
+ * get would produce changes. While the counter is unchanged requests are
+ * answered from the last document get produced without calling it. A
+ * successful set also invalidates a cached config document. Leave
+ * generation NULL to call get for every request.
+ *
+ * A config object with a set_delta callback is given the difference
+ * between the new configuration and the one it last applied successfully
+ * in place of calls to set, see vci_config_object_v2.set_delta.
+ */
+typedef struct {
+	void *obj;
+	int (*set)(void *obj, const void *in, size_t in_len, vci_error *error);
+	int (*check) (void *obj, const void *in, size_t in_len,
+				  vci_error *error);
+	void (*get) (void *obj, vci_buf *out);
+	void (*free)(void *obj);
+	uint64_t *generation;
+	/*
+	 * Optional. Receives {"added": {...}, "changed": {...},
+	 * "removed": {...}}, each mirroring the configuration but holding
+	 * only the affected subtrees: new members, the new values of changed
+	 * leaves and the old values of removed members. List entries are
+	 * matched by value, so a modified entry appears in "removed" with its
+	 * old value and in "added" with its new one, as does a member whose
+	 * value was replaced by one of another kind, such as an object by a
+	 * leaf. A null is reported like any other value. The first delta is
+	 * taken against an empty configuration. A failed set_delta leaves the
+	 * previously applied configuration as the base of the next delta. If
+	 * the applied configuration cannot be tracked, for instance after a
+	 * set_prepared, the next change is passed to set in full.
+	 */
+	int (*set_delta)(void *obj, const void *delta, size_t delta_len,
+					 vci_error *error);
+	/*
+	 * Optional, all three or none. check_prepare replaces check and may
+	 * store a token in *prepared, for instance the parsed candidate. If
+	 * the following set is for the same document the token is passed to
+	 * set_prepared in place of calling set or set_delta. Every token is
+	 * released through prepared_free exactly once: after set_prepared,
+	 * or once a later check or set shows its commit was abandoned.
+	 */
+	int (*check_prepare)(void *obj, const void *in, size_t in_len,
+						 void **prepared, vci_error *error);
+	int (*set_prepared)(void *obj, void *prepared, vci_error *error);
+	void (*prepared_free)(void *obj, void *prepared);
+} vci_config_object_v2;
+
+typedef struct {
+	void *obj;
+	void (*get) (void *obj, vci_buf *out);
+	void (*free)(void *obj);
+	uint64_t *generation;
+	/*
+	 * Optional, used in place of get. Writes the document in pieces with
+	 * vci_state_writer_write, so it never has to exist as one buffer on
+	 * the handler's side. The writer is only valid until stream returns.
+	 */
+	void (*stream)(void *obj, vci_state_writer *w);
+} vci_state_object_v2;
+
+/*
+ * Appends len bytes to the state document being streamed. reserve hints
+ * the size still to come so the document can be allocated once. Both
+ * return 0, or -1 if the writer is no longer valid. reserve sets errno
+ * to EBADF in that case, and fails with EOVERFLOW, reserving nothing, if
+ * len would take the document past INT32_MAX bytes.
+ */
+int vci_state_writer_write(vci_state_writer *w, const void *data, size_t len);
+int vci_state_writer_reserve(vci_state_writer *w, size_t len);
+/*
+ * Marks the state document being streamed as failed. What was written is
+ * dropped and the get is answered with an empty document, as if stream
+ * had written nothing.
+ */
+void vci_state_writer_fail(vci_state_writer *w);
+
+typedef struct {
+	void *obj;
+	int (*call) (void *obj, const void *in, size_t in_len,
+				 vci_buf *out, vci_error *error);
+	void (*free)(void *obj);
+} vci_rpc_object_v2;
+
+typedef struct {
+	void *obj;
+	int (*call) (void *obj, const void *meta, size_t meta_len,
+				 const void *in, size_t in_len,
+				 vci_buf *out, vci_error *error);
+	void (*free)(void *obj);
+} vci_rpc_meta_object_v2;
+
+typedef struct {
+	void *obj;
+	void (*subscriber)(void *obj, const void *in, size_t in_len);
+	void (*free)(void *obj);
+} vci_subscriber_object_v2;
+
+/*
+ * A batch subscriber is handed the notifications waiting for it together,
+ * in order and at most max_batch at a time (0 picks a default). With a
+ * non-zero max_delay_us a batch that is not full waits up to that long
+ * for more notifications before it is delivered. The array and the
+ * payloads it points to are only valid for the duration of the call.
+ */
+typedef struct {
+	void *obj;
+	void (*subscriber)(void *obj, const vci_payload *in, size_t count);
+	void (*free)(void *obj);
+	size_t max_batch;
+	uint32_t max_delay_us;
+} vci_batch_subscriber_object;
+
+/*
+ * An executor runs subscribers on a pool of threads rather than on the
+ * library's own. A subscription attached to one is delivered in order by
+ * one thread at a time, while different subscriptions run in parallel.
+ * vci_executor_new starts threads threads named after the executor; with
+ * threads 0 the application supplies its own by calling vci_executor_run,
+ * which delivers notifications until vci_executor_stop. Notifications
+ * waiting when an executor is stopped are dropped. Free an executor only
+ * after the subscriptions attached to it.
+ */
+vci_executor *vci_executor_new(const char *name, size_t threads);
+void vci_executor_run(vci_executor *exec);
+void vci_executor_stop(vci_executor *exec);
+void vci_executor_free(vci_executor *exec);
+
 vci_component * vci_component_new(const char* name);
 void vci_component_free(vci_component*);
 int vci_component_run(vci_component* comp, vci_error *error);
@@ -72,6 +248,18 @@ int vci_component_subscribe(vci_component* comp,
 							const char *notification_name,
 							const vci_subscriber_object* subscriber,
 							vci_error *error);
+int vci_component_subscribe_v2(vci_component* comp,
+							   const char *module_name,
+							   const char *notification_name,
+							   const vci_subscriber_object_v2* subscriber,
+							   vci_error *error);
+/*
+ * Subscriptions made after vci_component_set_executor are delivered by
+ * exec, through a ring of ring_size notifications (0 picks a default).
+ * A NULL exec goes back to the library's threads.
+ */
+void vci_component_set_executor(vci_component *comp, vci_executor *exec,
+								size_t ring_size);
 int vci_component_unsubscribe(vci_component* comp,
 							  const char *module_name,
 							  const char *notification_name,
@@ -85,6 +273,66 @@ void vci_model_rpc(vci_model *model, const char *module_name,
 				   const char *rpc_name, const vci_rpc_object* rpc);
 void vci_model_rpc_meta(vci_model *model, const char *module_name,
 				   const char *rpc_name, const vci_rpc_meta_object* rpc);
+void vci_model_config_v2(vci_model *model,
+						 const vci_config_object_v2* config);
+void vci_model_state_v2(vci_model *model, const vci_state_object_v2* state);
+void vci_model_rpc_v2(vci_model *model, const char *module_name,
+					  const char *rpc_name, const vci_rpc_object_v2* rpc);
+void vci_model_rpc_meta_v2(vci_model *model, const char *module_name,
+						   const char *rpc_name,
+						   const vci_rpc_meta_object_v2* rpc);
+/*
+ * Publishes the library's RPC statistics, see vci_stats_snapshot, and the
+ * admission statistics of the component's models as the state of this
+ * model using the vyatta-vci-stats-v1 YANG module. The model's component
+ * must list that module. Replaces any state object.
+ */
+void vci_model_stats(vci_model *model);
+/*
+ * Selects the encoding of every payload passed to, and returned by, the
+ * _v2 config, state and RPC objects registered on model after the call.
+ * Returns -1 if enc is unknown.
+ */
+int vci_model_set_encoding(vci_model *model, vci_encoding enc);
+
+/*
+ * Admission control. At most max_in_flight calls run in a model's
+ * handlers, or in one RPC's, at once and up to max_queued more wait
+ * their turn in arrival order; 0 leaves either unlimited. A call that
+ * finds the queue full fails at once with an operation-failed error whose
+ * app-tag is VCI_APP_TAG_OVERLOADED. RPCs pass their own limit and then
+ * their model's, config set and check pass the model's. Config and state
+ * gets count against the model's limit but wait rather than fail.
+ * Limits may be changed at any time, including before the RPC they apply
+ * to is registered.
+ */
+#define VCI_APP_TAG_OVERLOADED "vci-overloaded"
+void vci_model_set_admission(vci_model *model,
+							 uint32_t max_in_flight, uint32_t max_queued);
+void vci_model_set_rpc_admission(vci_model *model,
+								 const char *module, const char *name,
+								 uint32_t max_in_flight, uint32_t max_queued);
+/*
+ * The current limits and occupancy of a model's, or an RPC's, admission
+ * control, the number of calls admitted and rejected, and quantiles of
+ * the time admitted calls spent waiting, in nanoseconds.
+ */
+typedef struct {
+	uint32_t max_in_flight;
+	uint32_t max_queued;
+	uint32_t in_flight;
+	uint32_t queued;
+	uint64_t admitted;
+	uint64_t rejected;
+	uint64_t wait_p50_ns;
+	uint64_t wait_p99_ns;
+	uint64_t wait_p999_ns;
+} vci_admission_statistics;
+void vci_model_admission_stats(vci_model *model,
+							   vci_admission_statistics *stats);
+void vci_model_rpc_admission_stats(vci_model *model,
+								   const char *module, const char *name,
+								   vci_admission_statistics *stats);
 void vci_model_free(vci_model *model);
 
 int vci_client_dial(vci_client **client, vci_error *error);
@@ -92,28 +340,210 @@ void vci_client_free(vci_client *client);
 int vci_client_emit(vci_client *client,
 					const char *module, const char *name,
 					const char *data, vci_error *err);
+int vci_client_emit_v2(vci_client *client,
+					   const char *module, const char *name,
+					   const void *data, size_t data_len, vci_error *err);
+int vci_client_emit_encoded(vci_client *client,
+							const char *module, const char *name,
+							vci_encoding enc,
+							const void *data, size_t data_len,
+							vci_error *err);
 int vci_client_store_config_by_model_into(
 	vci_client *client ,const char *model, char **output, vci_error *err);
+int vci_client_store_config_by_model_into_v2(
+	vci_client *client, const char *model,
+	void **output, size_t *output_len, vci_error *err);
 int vci_client_store_state_by_model_into(
 	vci_client *client ,const char *model, char **output, vci_error *err);
+int vci_client_store_state_by_model_into_v2(
+	vci_client *client, const char *model,
+	void **output, size_t *output_len, vci_error *err);
+/*
+ * The _read_ variants hand the document to reader in order, in pieces of
+ * at most chunk_size bytes (0 picks a default), on the calling thread.
+ * Pieces point into the reply as received, so no copy of the whole
+ * document is made for the caller; each is only valid for the duration
+ * of the callback and is not NUL terminated. A non-zero return from
+ * reader stops the read and is returned as is. Otherwise the result is
+ * 0, or -1 with err set if the document could not be fetched.
+ */
+typedef int (*vci_chunk_reader)(void *ctx, const void *data, size_t len);
+int vci_client_read_config_by_model(
+	vci_client *client, const char *model, size_t chunk_size,
+	vci_chunk_reader reader, void *ctx, vci_error *err);
+int vci_client_read_state_by_model(
+	vci_client *client, const char *model, size_t chunk_size,
+	vci_chunk_reader reader, void *ctx, vci_error *err);
 
 vci_rpccall *vci_client_call(vci_client *client,
 							 const char *module, const char *name,
 							 const char *input);
+vci_rpccall *vci_client_call_v2(vci_client *client,
+								const char *module, const char *name,
+								const void *input, size_t input_len);
+/*
+ * Like vci_client_call_v2 with input, and the output collected through
+ * vci_rpccall_store_output_into_v2, in enc.
+ */
+vci_rpccall *vci_client_call_encoded(vci_client *client,
+									 const char *module, const char *name,
+									 vci_encoding enc,
+									 const void *input, size_t input_len);
+/*
+ * Called once with the outcome of an asynchronous call, on a library
+ * thread. On success rc is 0 and output holds the reply, otherwise rc is
+ * non-zero and err describes the failure. Both are only valid for the
+ * duration of the callback and output is not NUL terminated.
+ */
+typedef void (*vci_rpccall_callback)(void *ctx, int rc,
+									 const void *output, size_t output_len,
+									 vci_error *err);
+void vci_client_call_async(vci_client *client,
+						   const char *module, const char *name,
+						   const void *input, size_t input_len,
+						   vci_rpccall_callback cb, void *ctx);
+/*
+ * Issues count calls of the same RPC in one go, pipelining them on the
+ * bus, and fills results in input order. Returns 0 if every call
+ * succeeded and -1 otherwise, the per call outcome is in results[i].rc.
+ * Outputs follow the _v2 client conventions; release everything with
+ * vci_rpc_results_free.
+ */
+typedef struct {
+	int rc;
+	void *output;
+	size_t output_len;
+	vci_error err;
+} vci_rpc_result;
+
+int vci_client_call_batch(vci_client *client,
+						  const char *module, const char *name,
+						  const vci_payload *inputs, size_t count,
+						  vci_rpc_result *results);
+void vci_rpc_results_free(vci_rpc_result *results, size_t count);
 void vci_rpccall_free(vci_rpccall *call);
 int vci_rpccall_store_output_into(vci_rpccall *call,
 								  char **output, vci_error *err);
+int vci_rpccall_store_output_into_v2(vci_rpccall *call,
+									 void **output, size_t *output_len,
+									 vci_error *err);
 
 vci_subscription *vci_client_subscribe(
 	vci_client *client, const char *module, const char *name,
 	const vci_subscriber_object* subscriber);
+vci_subscription *vci_client_subscribe_v2(
+	vci_client *client, const char *module, const char *name,
+	const vci_subscriber_object_v2* subscriber);
+vci_subscription *vci_client_subscribe_batch(
+	vci_client *client, const char *module, const char *name,
+	const vci_batch_subscriber_object* subscriber);
 void vci_subscription_free(vci_subscription *sub);
 int vci_subscription_run(vci_subscription *sub, vci_error *err);
 int vci_subscription_cancel(vci_subscription *sub, vci_error *err);
 void vci_subscription_coalesce(vci_subscription *sub);
+/*
+ * Keeps only the latest waiting notification for each value found at
+ * path, a JSON pointer such as "/name" whose member names include any
+ * module prefix. Notifications stay in the order each key first arrived;
+ * those without a value at path are never coalesced. Returns -1 if path
+ * is not a valid JSON pointer.
+ */
+int vci_subscription_coalesce_by_key(vci_subscription *sub, const char *path);
 void vci_subscription_drop_after_limit(vci_subscription *sub, uint32_t limit);
 void vci_subscription_block_after_limit(vci_subscription *sub, uint32_t limit);
+/*
+ * Like vci_subscription_block_after_limit, but once high notifications
+ * are waiting the bus is held back until the subscriber has brought the
+ * queue down to low, rather than resuming as soon as there is room for
+ * one more. low is clamped below high.
+ */
+void vci_subscription_block_with_watermarks(vci_subscription *sub,
+											uint32_t high, uint32_t low);
 void vci_subscription_remove_limit(vci_subscription *sub);
+/*
+ * Selects the encoding notifications are delivered to a _v2 subscriber
+ * in; call before vci_subscription_run. Returns -1 if enc is unknown.
+ */
+int vci_subscription_set_encoding(vci_subscription *sub, vci_encoding enc);
+/*
+ * vci_subscription_fd moves the subscriber's calls onto the application's
+ * own thread; call it before vci_subscription_run. It returns an eventfd,
+ * owned by the subscription, which polls readable when notifications are
+ * pending, or -1 with errno set: EBUSY if the subscription has been
+ * given to an executor, or whatever eventfd(2) reports. Calling it again
+ * returns the same fd. vci_subscription_dispatch then calls the
+ * subscriber for up to max of them (0 for all), returning the number
+ * dispatched. Dispatch from one thread at a time. Once the fd is in use,
+ * delivered counts notifications handed over for dispatch.
+ */
+int vci_subscription_fd(vci_subscription *sub);
+int vci_subscription_dispatch(vci_subscription *sub, size_t max);
+/*
+ * Hands the subscription's notifications to exec through a ring of
+ * ring_size notifications (0 picks a default); call before
+ * vci_subscription_run. Returns -1 if the subscription is already
+ * dispatched through its fd or an executor.
+ */
+int vci_subscription_set_executor(vci_subscription *sub, vci_executor *exec,
+								  size_t ring_size);
+
+/*
+ * Counters for one subscription's delivery queue. depth is the number of
+ * notifications currently waiting and high_water the most that have
+ * waited at once. dropped and coalesced count notifications discarded by
+ * drop_after_limit and coalesce, dropped also counting any that could not
+ * be copied out to a batch subscriber for want of memory. blocked counts
+ * notifications that had to wait for room under block_after_limit and
+ * blocked_ns the total time they waited. The callback quantiles are the
+ * time spent in the subscriber, in nanoseconds.
+ */
+typedef struct {
+	uint64_t depth;
+	uint64_t high_water;
+	uint64_t delivered;
+	uint64_t dropped;
+	uint64_t coalesced;
+	uint64_t blocked;
+	uint64_t blocked_ns;
+	uint64_t callback_p50_ns;
+	uint64_t callback_p99_ns;
+	uint64_t callback_p999_ns;
+} vci_subscription_statistics;
+
+void vci_subscription_stats(vci_subscription *sub,
+							vci_subscription_statistics *stats);
+
+/*
+ * Statistics are kept for every RPC handled by a component in this
+ * process (client is 0) and for every RPC called through a client (client
+ * is 1, component and model are empty). bytes_in counts request payloads
+ * and bytes_out reply payloads. Handler latency covers the handler call,
+ * client latency the round trip from issuing the call to collecting its
+ * reply. Latency quantiles are in nanoseconds and are accurate to within
+ * an eighth.
+ */
+typedef struct {
+	char *component;
+	char *model;
+	char *module;
+	char *name;
+	int client;
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t latency_p50_ns;
+	uint64_t latency_p99_ns;
+	uint64_t latency_p999_ns;
+} vci_rpc_stats;
+
+/*
+ * Stores a newly allocated array of the current statistics in stats and
+ * its length in count. Returns 0 on success and -1 if the array could not
+ * be allocated. Release it with vci_stats_free.
+ */
+int vci_stats_snapshot(vci_rpc_stats **stats, size_t *count);
+void vci_stats_free(vci_rpc_stats *stats, size_t count);
 
 #ifdef __cplusplus
 }
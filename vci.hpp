@@ -9,6 +9,14 @@
 #include <map>
 #include <functional>
 #include <memory>
+#include <future>
+#include <vector>
+#include <chrono>
+
+struct vci_buf;
+struct vci_state_writer;
+struct vci_executor;
+struct vci_subscription;
 
 namespace _vci {
 	struct _CompImpl;
@@ -23,8 +31,21 @@ namespace vci {
 	typedef std::function<EncodedOutput(const EncodedInput&)> MethodFn;
 	typedef std::function<EncodedOutput(const EncodedInput&, const EncodedInput&)> MethodMetaFn;
 	typedef std::function<void(const EncodedInput&)> SubscriberFn;
+	typedef std::function<void(const std::vector<EncodedInput>&)> BatchSubscriberFn;
 
 	class Component;
+	class Exception;
+
+	typedef std::function<void(const EncodedOutput&)> RPCResultFn;
+	typedef std::function<void(const Exception&)> RPCErrorFn;
+	typedef std::function<void(const char *data, size_t len)> ChunkReaderFn;
+
+	// Encoding selects how payloads are exchanged with the library, see
+	// vci_encoding. EncodedInput and EncodedOutput hold CBOR as bytes.
+	enum class Encoding {
+		JSON,
+		CBOR,
+	};
 
 	class Exception {
 	public:
@@ -44,6 +65,61 @@ namespace vci {
 		std::string _path;
 	};
 
+	// EncodedView refers to a payload the library owns for the duration
+	// of a handler call, where an EncodedInput would hold a copy of it.
+	// Call str to keep the payload beyond the call.
+	class EncodedView {
+	public:
+		EncodedView() : _data(""), _size(0) {}
+		EncodedView(const char *data, size_t size)
+			: _data(data != NULL ? data : ""), _size(size) {}
+		EncodedView(const std::string& s) : _data(s.data()), _size(s.size()) {}
+		const char *data() const { return _data; }
+		size_t size() const { return _size; }
+		bool empty() const { return _size == 0; }
+		const char *begin() const { return _data; }
+		const char *end() const { return _data + _size; }
+		char operator[](size_t i) const { return _data[i]; }
+		std::string str() const { return std::string(_data, _size); }
+		explicit operator std::string() const { return this->str(); }
+	private:
+		const char *_data;
+		size_t _size;
+	};
+
+	inline bool operator==(EncodedView a, EncodedView b) {
+		return a.size() == b.size() &&
+			std::char_traits<char>::compare(a.data(), b.data(), a.size()) == 0;
+	}
+
+	inline bool operator!=(EncodedView a, EncodedView b) {
+		return !(a == b);
+	}
+
+	// Buffer wraps the library owned output buffer handed to the
+	// buffer writing handler overloads.
+	class Buffer {
+	public:
+		explicit Buffer(vci_buf *buf) : _buf(buf) {}
+		void reserve(size_t len);
+		void append(const char *data, size_t len);
+		void append(const std::string& data);
+		void append(EncodedView data) { this->append(data.data(), data.size()); }
+		size_t size() const;
+		friend class Client;
+	private:
+		vci_buf *_buf;
+	};
+
+	// The get and operator() overloads taking a Buffer write their result
+	// straight into library owned memory. Handlers implement the returning
+	// forms, whose results the Buffer forms copy out, unless they derive
+	// from the Buffer classes below, which implement the Buffer forms
+	// instead.
+	//
+	// The library passes inputs to the overloads taking an EncodedView,
+	// which copy them into an EncodedInput for the original forms. The
+	// View classes below turn that around for handlers that want no copy.
 	class Config {
 	public:
 		virtual void set(
@@ -52,30 +128,228 @@ namespace vci {
 			const EncodedInput& input)  = 0;
 		virtual EncodedOutput get() { return "{}"; }
 		virtual ~Config() {};
+		virtual void get(Buffer& out) { out.append(this->get()); }
+		virtual void set(EncodedView input) { this->set(input.str()); }
+		virtual void check(EncodedView input) { this->check(input.str()); }
+	};
+
+	// ViewConfig is a Config whose set and check read the library's
+	// payload in place.
+	class ViewConfig : public virtual Config {
+	public:
+		virtual void set(EncodedView input) = 0;
+		virtual void check(EncodedView input) = 0;
+		virtual void set(const EncodedInput& input) {
+			this->set(EncodedView(input));
+		}
+		virtual void check(const EncodedInput& input) {
+			this->check(EncodedView(input));
+		}
 	};
 
 	class State {
 	public:
 		virtual EncodedOutput get() = 0;
 		virtual ~State() {};
+		virtual void get(Buffer& out) { out.append(this->get()); }
+	};
+
+	// BufferState writes its document straight into the library's buffer.
+	class BufferState : public virtual State {
+	public:
+		virtual void get(Buffer& out) = 0;
+		virtual EncodedOutput get();
+	};
+
+	// CachedConfig and CachedState opt in to serving requests from the
+	// last document get produced. Call invalidate whenever that document
+	// would change; a successful set invalidates a CachedConfig itself.
+	class CachedConfig : public virtual Config {
+	public:
+		void invalidate();
+		friend class Component;
+	private:
+		uint64_t _generation = 0;
+	};
+
+	class CachedState : public virtual State {
+	public:
+		void invalidate();
+		friend class Component;
+	private:
+		uint64_t _generation = 0;
+	};
+
+	// StateWriter passes a state document on in pieces, see
+	// vci_state_object_v2.stream.
+	class StateWriter {
+	public:
+		explicit StateWriter(vci_state_writer *w) : _w(w), _buf(NULL) {}
+		explicit StateWriter(Buffer *buf) : _w(NULL), _buf(buf) {}
+		void reserve(size_t len);
+		void write(const char *data, size_t len);
+		void write(const std::string& data);
+	private:
+		vci_state_writer *_w;
+		Buffer *_buf;
+	};
+
+	// StreamingState writes its document through a StateWriter rather
+	// than building it in one piece. If get throws, the state is read as
+	// an empty document.
+	class StreamingState : public virtual BufferState {
+	public:
+		using BufferState::get;
+		virtual void get(StateWriter& out) = 0;
+		virtual void get(Buffer& out) {
+			StateWriter w(&out);
+			this->get(w);
+		}
+	};
+
+	// DeltaConfig is given each configuration change as a delta against
+	// the configuration it last applied, as described for
+	// vci_config_object_v2.set_delta, in place of calls to set. set is
+	// still called with the full configuration when the library cannot
+	// compute a delta.
+	class DeltaConfig : public virtual Config {
+	public:
+		using Config::set;
+		virtual void set_delta(const EncodedInput& delta) = 0;
+		virtual void set_delta(EncodedView delta) {
+			this->set_delta(delta.str());
+		}
+	};
+
+	// PreparedConfig lets check hand its work to the set that follows.
+	// prepare validates a candidate like check and returns whatever
+	// set_prepared needs to apply it; the library passes it on when set
+	// is called with the same document and calls set otherwise.
+	class PreparedConfig : public virtual Config {
+	public:
+		using Config::check;
+		virtual std::shared_ptr<void> prepare(const EncodedInput& input) = 0;
+		virtual void set_prepared(const std::shared_ptr<void>& prepared) = 0;
+		virtual void check(const EncodedInput& input) { this->prepare(input); }
+		virtual std::shared_ptr<void> prepare(EncodedView input) {
+			return this->prepare(input.str());
+		}
 	};
 
 	class Method {
 	public:
 		virtual EncodedOutput operator()(const EncodedInput& input) = 0;
 		virtual ~Method() {};
+		virtual void operator()(const EncodedInput& input, Buffer& out) {
+			out.append(this->operator()(input));
+		}
+		virtual void operator()(EncodedView input, Buffer& out) {
+			this->operator()(input.str(), out);
+		}
+	};
+
+	// BufferMethod writes its output straight into the library's buffer.
+	class BufferMethod : public Method {
+	public:
+		using Method::operator();
+		virtual void operator()(const EncodedInput& input, Buffer& out) = 0;
+		virtual EncodedOutput operator()(const EncodedInput& input);
+	};
+
+	// ViewMethod reads its input in place and writes its output to the
+	// library's buffer, so a call copies neither.
+	class ViewMethod : public BufferMethod {
+	public:
+		using BufferMethod::operator();
+		virtual void operator()(EncodedView input, Buffer& out) = 0;
+		virtual void operator()(const EncodedInput& input, Buffer& out) {
+			this->operator()(EncodedView(input), out);
+		}
+	};
+
+	// Codec maps a type to and from payloads for the typed Model::rpc and
+	// Client::call templates. Specialise it for each type used with
+	//     static void decode(EncodedView in, T& out);
+	//     static void encode(const T& in, Buffer& out);
+	// where decode throws a vci::Exception for a payload it cannot read.
+	template <typename T> struct Codec;
+
+	// Codec<std::string> passes the payload through as it is.
+	template <> struct Codec<std::string> {
+		static void decode(EncodedView in, std::string& out) {
+			out.assign(in.data(), in.size());
+		}
+		static void encode(const std::string& in, Buffer& out) {
+			out.append(in);
+		}
+	};
+
+	// TypedMethod is the Method a typed Model::rpc registers: it decodes
+	// the input from the library's payload and encodes fn's result
+	// straight into the output buffer.
+	template <typename In, typename Out, typename Fn>
+	class TypedMethod : public ViewMethod {
+	public:
+		explicit TypedMethod(Fn fn) : _fn(std::move(fn)) {}
+		using ViewMethod::operator();
+		virtual void operator()(EncodedView input, Buffer& out) {
+			In in;
+			Codec<In>::decode(input, in);
+			Codec<Out>::encode(_fn(in), out);
+		}
+	private:
+		Fn _fn;
 	};
 
 	class MethodMeta {
 	public:
 		virtual EncodedOutput operator()(const EncodedInput& meta, const EncodedInput& input) = 0;
 		virtual ~MethodMeta() {};
+		virtual void operator()(const EncodedInput& meta,
+								const EncodedInput& input, Buffer& out) {
+			out.append(this->operator()(meta, input));
+		}
+		virtual void operator()(EncodedView meta, EncodedView input,
+								Buffer& out) {
+			this->operator()(meta.str(), input.str(), out);
+		}
+	};
+
+	class BufferMethodMeta : public MethodMeta {
+	public:
+		using MethodMeta::operator();
+		virtual void operator()(const EncodedInput& meta,
+								const EncodedInput& input, Buffer& out) = 0;
+		virtual EncodedOutput operator()(const EncodedInput& meta,
+										 const EncodedInput& input);
+	};
+
+	class ViewMethodMeta : public BufferMethodMeta {
+	public:
+		using BufferMethodMeta::operator();
+		virtual void operator()(EncodedView meta, EncodedView input,
+								Buffer& out) = 0;
+		virtual void operator()(const EncodedInput& meta,
+								const EncodedInput& input, Buffer& out) {
+			this->operator()(EncodedView(meta), EncodedView(input), out);
+		}
 	};
 
 	class Subscriber {
 	public:
 		virtual void operator()(const EncodedInput& input) = 0;
 		virtual ~Subscriber() {};
+		virtual void operator()(EncodedView input) {
+			this->operator()(input.str());
+		}
+	};
+
+	class ViewSubscriber : public Subscriber {
+	public:
+		virtual void operator()(EncodedView input) = 0;
+		virtual void operator()(const EncodedInput& input) {
+			this->operator()(EncodedView(input));
+		}
 	};
 
 	class Model {
@@ -94,11 +368,38 @@ namespace vci {
 				   MethodMeta* rpc);
 		Model& rpc(const std::string& module,
 				   const std::string& name, MethodMetaFn rpc);
+		// rpc<In, Out> registers fn, callable as Out(const In&), with
+		// its input and output converted by Codec<In> and Codec<Out>.
+		template <typename In, typename Out, typename Fn>
+		Model& rpc(const std::string& module,
+				   const std::string& name, Fn fn) {
+			return this->rpc(module, name,
+							 new TypedMethod<In, Out, Fn>(std::move(fn)));
+		}
+		// stats publishes the library's RPC and admission
+		// statistics as this model's state, in place of any State
+		// object.
+		Model& stats();
+		// admission limits the calls running in this model's
+		// handlers, or in one of its RPCs, see
+		// vci_model_set_admission.
+		Model& admission(uint32_t max_in_flight, uint32_t max_queued);
+		Model& admission(const std::string& module,
+						 const std::string& name,
+						 uint32_t max_in_flight, uint32_t max_queued);
+		// encoding applies to every payload of this model's config,
+		// state and RPCs.
+		Model& encoding(Encoding enc);
 		friend class Component;
 	private:
 		std::string _name;
+		Encoding _encoding = Encoding::JSON;
 		Config* _config = NULL;
 		State* _state = NULL;
+		bool _stats = false;
+		// Keyed by module and RPC name, both empty for the model.
+		std::map<std::pair<std::string, std::string>,
+				 std::pair<uint32_t, uint32_t>> _admission;
 		std::map<std::string,
 				 std::map<std::string, vci::Method*>> _methods;
 		std::map<std::string,
@@ -107,6 +408,23 @@ namespace vci {
 
 	class Client;
 
+	// Executor runs subscribers on threads of its own, see
+	// vci_executor_new. With threads 0 the application lends threads by
+	// calling run, which delivers notifications until stop.
+	class Executor {
+	public:
+		Executor(const std::string& name, size_t threads);
+		Executor(const Executor&) = delete;
+		Executor& operator=(const Executor&) = delete;
+		~Executor();
+		void run();
+		void stop();
+		friend class Component;
+		friend class Client;
+	private:
+		vci_executor* _exec;
+	};
+
 	class Component {
 	public:
 		Component(std::string name);
@@ -121,6 +439,9 @@ namespace vci {
 							 SubscriberFn subscriber);
 		Component& unsubscribe(const std::string& module,
 							   const std::string& notification);
+		// Subscriptions made after executor are delivered by exec.
+		Component& executor(std::shared_ptr<Executor> exec,
+							size_t ring_size = 0);
 		Component& model(Model& model);
 		std::shared_ptr<Client> client();
 		~Component();
@@ -138,6 +459,54 @@ namespace vci {
 		_vci::_RPCCallImpl* _impl;
 	};
 
+	// RPCResult holds the outcome of one call of a batch.
+	class RPCResult {
+	public:
+		RPCResult(const EncodedOutput& output);
+		RPCResult(const Exception& error);
+		bool ok() const;
+		// output returns the reply, or throws the call's vci::Exception.
+		const EncodedOutput& output() const;
+		const Exception* error() const;
+	private:
+		EncodedOutput _output;
+		std::shared_ptr<Exception> _error;
+	};
+
+	// RPCStats holds the statistics kept for one RPC, as described for
+	// vci_stats_snapshot.
+	struct RPCStats {
+		std::string component;
+		std::string model;
+		std::string module;
+		std::string name;
+		bool client;
+		uint64_t calls;
+		uint64_t errors;
+		uint64_t bytes_in;
+		uint64_t bytes_out;
+		uint64_t latency_p50_ns;
+		uint64_t latency_p99_ns;
+		uint64_t latency_p999_ns;
+	};
+
+	std::vector<RPCStats> stats_snapshot();
+
+	// SubscriptionStats holds the delivery queue counters described
+	// for vci_subscription_stats.
+	struct SubscriptionStats {
+		uint64_t depth;
+		uint64_t high_water;
+		uint64_t delivered;
+		uint64_t dropped;
+		uint64_t coalesced;
+		uint64_t blocked;
+		uint64_t blocked_ns;
+		uint64_t callback_p50_ns;
+		uint64_t callback_p99_ns;
+		uint64_t callback_p999_ns;
+	};
+
 	class Subscription {
 	public:
 		Subscription();
@@ -145,9 +514,20 @@ namespace vci {
 		void run();
 		void cancel();
 		void coalesce();
+		// coalesce_by_key keeps the latest notification per value at the
+		// JSON pointer path, see vci_subscription_coalesce_by_key.
+		void coalesce_by_key(const std::string& path);
 		void drop_after_limit(uint32_t limit);
 		void block_after_limit(uint32_t limit);
+		void block_with_watermarks(uint32_t high, uint32_t low);
 		void remove_limit();
+		SubscriptionStats stats();
+		// Call encoding before run.
+		void encoding(Encoding enc);
+		// Call fd before run, then dispatch when it polls readable to run
+		// the subscriber on this thread, see vci_subscription_fd.
+		int fd();
+		size_t dispatch(size_t max = 0);
 		friend class Client;
 	private:
 		_vci::_SubscriptionImpl* _impl;
@@ -160,22 +540,116 @@ namespace vci {
 		std::shared_ptr<RPCCall> call(
 			const std::string& module, const std::string& name,
 			const EncodedInput& input);
+		std::shared_ptr<RPCCall> call(
+			const std::string& module, const std::string& name,
+			const EncodedInput& input, Encoding enc);
+		// call_with has encode, called as encode(Buffer&), write the
+		// input into a library buffer and passes the reply to decode,
+		// called as decode(EncodedView), in place; it waits for the
+		// reply and throws the call's vci::Exception if it fails.
+		template <typename Encode, typename Decode>
+		void call_with(const std::string& module, const std::string& name,
+					   Encode encode, Decode decode) {
+			_Input input;
+			encode(input.buffer);
+			_Reply reply = this->_call_buffered(module, name, input.buffer);
+			decode(reply.view());
+		}
+		// call<In, Out> calls with input converted by Codec<In> and
+		// returns the reply converted by Codec<Out>.
+		template <typename In, typename Out>
+		Out call(const std::string& module, const std::string& name,
+				 const In& input) {
+			Out out;
+			this->call_with(module, name,
+							[&input](Buffer& buf) { Codec<In>::encode(input, buf); },
+							[&out](EncodedView reply) { Codec<Out>::decode(reply, out); });
+			return out;
+		}
+		// The asynchronous calls return immediately. Callbacks run
+		// on a library thread once the reply arrives; anything they
+		// throw is discarded.
+		std::future<EncodedOutput> call_async(
+			const std::string& module, const std::string& name,
+			const EncodedInput& input);
+		void call_async(
+			const std::string& module, const std::string& name,
+			const EncodedInput& input,
+			RPCResultFn on_result, RPCErrorFn on_error);
+		// call_batch issues every call before waiting on any reply and
+		// returns the results in input order.
+		std::vector<RPCResult> call_batch(
+			const std::string& module, const std::string& name,
+			const std::vector<EncodedInput>& inputs);
 		void emit(
 			const std::string& module, const std::string& name,
 			const EncodedInput& data);
+		void emit(
+			const std::string& module, const std::string& name,
+			const EncodedInput& data, Encoding enc);
 		EncodedOutput config_by_model(
 			const std::string& model);
 		EncodedOutput state_by_model(
 			const std::string& model);
+		// The read_ calls hand the document to reader in pieces of at
+		// most chunk_size bytes instead of returning a copy of it. An
+		// exception thrown by reader stops the read and is rethrown.
+		void read_config_by_model(
+			const std::string& model, ChunkReaderFn reader,
+			size_t chunk_size = 0);
+		void read_state_by_model(
+			const std::string& model, ChunkReaderFn reader,
+			size_t chunk_size = 0);
 		std::shared_ptr<Subscription> subscribe(
 			const std::string& module, const std::string& name,
 			Subscriber* subscriber);
 		std::shared_ptr<Subscription> subscribe(
 			const std::string& module, const std::string& name,
 			SubscriberFn subscriber);
+		// subscribe_batch hands subscriber the notifications waiting for
+		// it, at most max_batch at a time, see vci_batch_subscriber_object.
+		std::shared_ptr<Subscription> subscribe_batch(
+			const std::string& module, const std::string& name,
+			BatchSubscriberFn subscriber, size_t max_batch = 0,
+			std::chrono::microseconds max_delay =
+				std::chrono::microseconds::zero());
+		// Subscriptions made after executor are delivered by exec.
+		void executor(std::shared_ptr<Executor> exec, size_t ring_size = 0);
 		friend class Component;
 	private:
 		Client(_vci::_ClientImpl* impl);
+		std::shared_ptr<Subscription> _subscription(vci_subscription* sub);
+		// _Reply owns the reply to a call_with until it is decoded.
+		class _Reply {
+		public:
+			_Reply(void *data, size_t len) : _data(data), _len(len) {}
+			_Reply(_Reply&& other) : _data(other._data), _len(other._len) {
+				other._data = NULL;
+			}
+			~_Reply();
+			EncodedView view() const {
+				return EncodedView((const char *) _data, _len);
+			}
+		private:
+			_Reply(const _Reply&);
+			_Reply& operator=(const _Reply&);
+			void *_data;
+			size_t _len;
+		};
+		// _Input checks the buffer the input of a call_with is written
+		// into out of a per thread pool, and returns it once the call is
+		// made, so that nested calls each have their own.
+		class _Input {
+		public:
+			_Input();
+			~_Input();
+			Buffer buffer;
+		private:
+			_Input(const _Input&);
+			_Input& operator=(const _Input&);
+		};
+		_Reply _call_buffered(const std::string& module,
+							  const std::string& name, Buffer& input);
 		_vci::_ClientImpl* _impl;
 	};
 }